@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <libusb-1.0/libusb.h>
+
+#include "ztex.h"
+#include "inouttraffic.h"
+#include "pkt_comm/pkt_comm.h"
+#include "pkt_comm/outpkt.h"
+#include "spsc_ring.h"
+#include "board_worker.h"
+
+
+// Move packets from the scheduler into output queue,
+// delete packets released by the scheduler
+static void board_worker_get_packets(struct board_worker *worker, int num)
+{
+	struct board_worker_fpga *wfpga = &worker->fpga[num];
+	struct pkt_comm *comm = worker->device->fpga[num].comm;
+	struct pkt *pkt;
+
+	while ( (pkt = spsc_ring_pop(wfpga->release)) )
+		pkt_delete(pkt);
+
+	for ( ; ; ) {
+		pkt = wfpga->pending;
+		wfpga->pending = NULL;
+		if (!pkt && !(pkt = spsc_ring_pop(wfpga->to_device)))
+			break;
+		if (pkt_comm_output_push(comm, pkt) < 0) {
+			wfpga->pending = pkt;
+			break;
+		}
+	}
+}
+
+// Move received packets to the scheduler
+static void board_worker_put_packets(struct board_worker *worker, int num)
+{
+	struct board_worker_fpga *wfpga = &worker->fpga[num];
+	struct pkt_queue *input_queue = worker->device->fpga[num].comm->input_queue;
+	struct pkt *pkt;
+
+	while ( (pkt = pkt_queue_peek(input_queue)) ) {
+		if (spsc_ring_push(wfpga->from_device, pkt) < 0)
+			break;
+		pkt_queue_fetch(input_queue);
+	}
+}
+
+static uint64_t board_worker_time_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// USB transfers performed with the FPGA
+static uint64_t fpga_rt_count(struct fpga *fpga)
+{
+	return fpga->cmd_count + fpga->wr.wr_count
+		+ fpga->rd.read_count + fpga->rd.partial_read_count;
+}
+
+// Selects FPGA, gets its status, performs write and read
+// Returns < 0 on error
+static int board_worker_visit(struct board_worker *worker, int num,
+		int *wr_len, int *rd_len)
+{
+	struct device *device = worker->device;
+	struct fpga *fpga = &device->fpga[num];
+	int result;
+
+	// combines fpga_select(), fpga_get_io_state() and fpga_setup_output() in 1 USB request
+	result = fpga_select_setup_io(fpga);
+	if (result < 0) {
+		fprintf(stderr, "SN %s FPGA #%d fpga_select_setup_io() error: %d\n",
+			device->ztex_device->snString, num, result);
+		return result;
+	}
+
+	if (fpga->wr.io_state.pkt_comm_status) {
+		fprintf(stderr, "SN %s FPGA #%d error: pkt_comm_status=0x%02x\n",
+			device->ztex_device->snString, num, fpga->wr.io_state.pkt_comm_status);
+		return -1;
+	}
+
+	if (fpga->wr.io_state.app_status) {
+		fprintf(stderr, "SN %s FPGA #%d error: app_status=0x%02x\n",
+			device->ztex_device->snString, num, fpga->wr.io_state.app_status);
+		return -1;
+	}
+
+	result = fpga_pkt_write(fpga);
+	if (result < 0) {
+		fprintf(stderr, "SN %s FPGA #%d write error: %d (%s)\n",
+			device->ztex_device->snString, num, result, libusb_strerror(result));
+		return result;
+	}
+	worker->wr_byte_count += result;
+	*wr_len = result;
+
+	// Output FIFO had more data than one read takes:
+	// reading again with a new read_limit (VR 0x85)
+	int read_count;
+	for (read_count = 0; read_count < BOARD_WORKER_READS_MAX; read_count++) {
+		result = fpga_pkt_read(fpga);
+		if (result < 0) {
+			fprintf(stderr, "SN %s FPGA #%d read error: %d (%s)\n",
+				device->ztex_device->snString, num, result, libusb_strerror(result));
+			return result;
+		}
+		worker->rd_byte_count += result;
+		*rd_len += result;
+		if (result < fpga->comm->params->input_max_len)
+			break;
+	}
+
+	return 0;
+}
+
+static void rate_update(double *rate, double sample)
+{
+	*rate = *rate == 0 ? sample : *rate * 0.875 + sample * 0.125;
+}
+
+static int wait_clamp(double usec)
+{
+	return usec < BOARD_WORKER_POLL_MIN_USEC ? BOARD_WORKER_POLL_MIN_USEC
+		: usec > BOARD_WORKER_POLL_MAX_USEC ? BOARD_WORKER_POLL_MAX_USEC
+		: (int)usec;
+}
+
+// Updates rate estimates after the visit, sets time of the next visit
+static void board_worker_schedule(struct board_worker *worker, int num,
+		uint64_t now, int wr_len, int rd_len)
+{
+	struct board_worker_fpga *wfpga = &worker->fpga[num];
+	struct fpga *fpga = &worker->device->fpga[num];
+	struct pkt_comm *comm = fpga->comm;
+	// status before the write
+	int input_full = fpga->wr.io_state.io_state & IO_STATE_INPUT_PROG_FULL;
+
+	// Drain rate: bytes written between INPUT_PROG_FULL 1->0 transitions.
+	// While input stays not full, FPGA takes everything written:
+	// bytes written over the rate interval are a lower bound.
+	if (!wfpga->drain_start_usec)
+		wfpga->drain_start_usec = now;
+	else if (wfpga->input_full && !input_full) {
+		if (now > wfpga->drain_start_usec) {
+			rate_update(&wfpga->drain_rate, (double)wfpga->drain_bytes
+				/ (now - wfpga->drain_start_usec));
+			wfpga->drain_samples++;
+		}
+		wfpga->drain_start_usec = now;
+		wfpga->drain_bytes = 0;
+	}
+	else if (!wfpga->input_full && !input_full && now
+			- wfpga->drain_start_usec >= BOARD_WORKER_RATE_INTERVAL_USEC) {
+		double rate = (double)wfpga->drain_bytes
+				/ (now - wfpga->drain_start_usec);
+		if (rate > wfpga->drain_rate) {
+			rate_update(&wfpga->drain_rate, rate);
+			wfpga->drain_samples++;
+		}
+		wfpga->drain_start_usec = now;
+		wfpga->drain_bytes = 0;
+	}
+	wfpga->drain_bytes += wr_len;
+	if (wr_len)
+		wfpga->last_wr_len = wr_len;
+
+	// Input became full. It accepts more data after it takes about
+	// as much as the last write. Waiting less if it's still full.
+	if (input_full)
+		wfpga->full_wait_usec = !wfpga->input_full
+			? wait_clamp(wfpga->drain_rate
+				? wfpga->last_wr_len / wfpga->drain_rate : 0)
+			: wait_clamp(wfpga->full_wait_usec / 2);
+	wfpga->input_full = input_full;
+
+	// Output rate from read_limit history
+	wfpga->output_bytes += rd_len;
+	if (!wfpga->output_start_usec)
+		wfpga->output_start_usec = now;
+	else if (now - wfpga->output_start_usec >= BOARD_WORKER_RATE_INTERVAL_USEC) {
+		rate_update(&wfpga->output_rate, (double)wfpga->output_bytes
+			/ (now - wfpga->output_start_usec));
+		wfpga->output_samples++;
+		wfpga->output_start_usec = now;
+		wfpga->output_bytes = 0;
+	}
+	wfpga->output_backlog = rd_len && fpga->rd.read_limit >= comm->params->input_max_len
+		&& fpga->rd.rd_done;
+
+	int wait;
+	if (wfpga->output_backlog)
+		wait = 0;
+	else if (fpga->rd.read_limit && !fpga->rd.rd_done)
+		// no input buffer on the host
+		wait = BOARD_WORKER_POLL_MIN_USEC;
+	else
+		wait = wait_clamp(wfpga->output_rate
+			? comm->params->input_max_len / 2 / wfpga->output_rate
+			: BOARD_WORKER_POLL_MAX_USEC);
+
+	if (input_full && pkt_comm_output_pending(comm) && wait > wfpga->full_wait_usec)
+		wait = wfpga->full_wait_usec;
+
+	wfpga->next_visit_usec = now + wait;
+}
+
+// FPGA is visited without delay if there's data for it
+// and its input wasn't full
+static int board_worker_visit_now(struct board_worker *worker, int num,
+		uint64_t now)
+{
+	struct board_worker_fpga *wfpga = &worker->fpga[num];
+	return now >= wfpga->next_visit_usec || (!wfpga->input_full
+		&& pkt_comm_output_pending(worker->device->fpga[num].comm) );
+}
+
+// Performs I/O with FPGAs that are due for a visit.
+// Stores time of the earliest next visit in *next_usec.
+// Returns number of visits, < 0 on error
+static int board_worker_rw(struct board_worker *worker, uint64_t *next_usec)
+{
+	struct device *device = worker->device;
+	int visit_count = 0;
+	int num;
+
+	*next_usec = UINT64_MAX;
+	for (num = 0; num < device->num_of_fpgas; num++) {
+		struct board_worker_fpga *wfpga = &worker->fpga[num];
+		struct fpga *fpga = &device->fpga[num];
+		uint64_t now = board_worker_time_usec();
+
+		board_worker_get_packets(worker, num);
+		board_worker_put_packets(worker, num);
+
+		if (!board_worker_visit_now(worker, num, now)) {
+			worker->skip_count++;
+			if (*next_usec > wfpga->next_visit_usec)
+				*next_usec = wfpga->next_visit_usec;
+			continue;
+		}
+
+		uint64_t rt_count = fpga_rt_count(fpga);
+		int wr_len = 0, rd_len = 0;
+		int result = board_worker_visit(worker, num, &wr_len, &rd_len);
+		worker->rt_count += fpga_rt_count(fpga) - rt_count;
+		worker->visit_count++;
+		visit_count++;
+		if (result < 0)
+			return result;
+
+		board_worker_schedule(worker, num, now, wr_len, rd_len);
+		board_worker_put_packets(worker, num);
+	}
+	worker->round_count++;
+	return visit_count;
+}
+
+// Returns true if the scheduler sent data to an FPGA
+// that can accept it
+static int board_worker_has_work(struct board_worker *worker)
+{
+	int num;
+	for (num = 0; num < worker->device->num_of_fpgas; num++)
+		if (!worker->fpga[num].input_full
+				&& spsc_ring_count(worker->fpga[num].to_device))
+			return 1;
+	return 0;
+}
+
+// Sleeps until 'until_usec' or board_worker_send()
+static void board_worker_sleep(struct board_worker *worker, uint64_t until_usec)
+{
+	pthread_mutex_lock(&worker->lock);
+	atomic_store(&worker->sleeping, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load(&worker->stop) && !board_worker_has_work(worker)) {
+		struct timespec ts;
+		ts.tv_sec = until_usec / 1000000;
+		ts.tv_nsec = until_usec % 1000000 * 1000;
+		pthread_cond_timedwait(&worker->cond, &worker->lock, &ts);
+		worker->sleep_count++;
+	}
+	atomic_store(&worker->sleeping, 0);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+static void board_worker_wakeup(struct board_worker *worker)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load(&worker->sleeping))
+		return;
+	pthread_mutex_lock(&worker->lock);
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+static void *board_worker_thread(void *arg)
+{
+	struct board_worker *worker = arg;
+
+	while (!atomic_load(&worker->stop)) {
+		uint64_t next_usec;
+		int result = board_worker_rw(worker, &next_usec);
+		if (result < 0) {
+			atomic_store(&worker->error, result);
+			break;
+		}
+		if (!result) {
+			if (next_usec == UINT64_MAX)
+				next_usec = board_worker_time_usec() + BOARD_WORKER_POLL_MAX_USEC;
+			board_worker_sleep(worker, next_usec);
+		}
+	}
+	return NULL;
+}
+
+static void board_worker_free(struct board_worker *worker)
+{
+	int num;
+	for (num = 0; num < DEVICE_FPGAS_MAX; num++) {
+		struct board_worker_fpga *wfpga = &worker->fpga[num];
+		struct spsc_ring *ring[3] = { wfpga->to_device, wfpga->from_device,
+				wfpga->release };
+		int i;
+		for (i = 0; i < 3; i++) {
+			if (!ring[i])
+				continue;
+			struct pkt *pkt;
+			while ( (pkt = spsc_ring_pop(ring[i])) )
+				pkt_delete(pkt);
+			spsc_ring_delete(ring[i]);
+		}
+		if (wfpga->pending)
+			pkt_delete(wfpga->pending);
+	}
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->lock);
+	free(worker);
+}
+
+struct board_worker *board_worker_new(struct device *device)
+{
+	struct board_worker *worker = calloc(1, sizeof(struct board_worker));
+	if (!worker)
+		return NULL;
+	worker->device = device;
+
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&worker->cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+	pthread_mutex_init(&worker->lock, NULL);
+	atomic_init(&worker->sleeping, 0);
+	atomic_init(&worker->stop, 0);
+	atomic_init(&worker->error, 0);
+	atomic_init(&worker->wr_byte_count, 0);
+	atomic_init(&worker->rd_byte_count, 0);
+	atomic_init(&worker->round_count, 0);
+	atomic_init(&worker->rt_count, 0);
+	atomic_init(&worker->visit_count, 0);
+	atomic_init(&worker->skip_count, 0);
+	atomic_init(&worker->sleep_count, 0);
+	worker->start_usec = board_worker_time_usec();
+
+	int num;
+	for (num = 0; num < device->num_of_fpgas; num++) {
+		struct board_worker_fpga *wfpga = &worker->fpga[num];
+		if (!device->fpga[num].comm) {
+			fprintf(stderr, "board_worker_new: SN %s FPGA #%d has no pkt_comm\n",
+				device->ztex_device->snString, num);
+			board_worker_free(worker);
+			return NULL;
+		}
+		wfpga->to_device = spsc_ring_new(BOARD_WORKER_RING_SIZE);
+		wfpga->from_device = spsc_ring_new(BOARD_WORKER_RING_SIZE);
+		wfpga->release = spsc_ring_new(BOARD_WORKER_RING_SIZE);
+		if (!wfpga->to_device || !wfpga->from_device || !wfpga->release) {
+			board_worker_free(worker);
+			return NULL;
+		}
+	}
+
+	int result = pthread_create(&worker->thread, NULL, board_worker_thread, worker);
+	if (result) {
+		fprintf(stderr, "board_worker_new: pthread_create: %s\n", strerror(result));
+		board_worker_free(worker);
+		return NULL;
+	}
+	return worker;
+}
+
+void board_worker_stop(struct board_worker *worker)
+{
+	if (worker->stopped)
+		return;
+	atomic_store(&worker->stop, 1);
+	pthread_mutex_lock(&worker->lock);
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+	pthread_join(worker->thread, NULL);
+	worker->stopped = 1;
+}
+
+void board_worker_delete(struct board_worker *worker)
+{
+	board_worker_stop(worker);
+
+	// Worker has stopped, packets in its output and input queues
+	// are deleted with pkt_comm
+	board_worker_free(worker);
+}
+
+int board_worker_error(struct board_worker *worker)
+{
+	return atomic_load(&worker->error);
+}
+
+int board_worker_send(struct board_worker *worker, int fpga_num, struct pkt *pkt)
+{
+	if (spsc_ring_push(worker->fpga[fpga_num].to_device, pkt) < 0)
+		return -1;
+	board_worker_wakeup(worker);
+	return 0;
+}
+
+int board_worker_space(struct board_worker *worker, int fpga_num)
+{
+	struct spsc_ring *ring = worker->fpga[fpga_num].to_device;
+	return ring->size - spsc_ring_count(ring);
+}
+
+struct pkt *board_worker_recv(struct board_worker *worker, int fpga_num)
+{
+	return spsc_ring_pop(worker->fpga[fpga_num].from_device);
+}
+
+void board_worker_release(struct board_worker *worker, int fpga_num, struct pkt *pkt)
+{
+	// The worker empties the ring on every visit to the FPGA
+	while (spsc_ring_push(worker->fpga[fpga_num].release, pkt) < 0) {
+		if (board_worker_error(worker)) {
+			// worker has stopped, its pkt_comm is still there
+			pkt_delete(pkt);
+			return;
+		}
+		sched_yield();
+	}
+}
+
+int board_worker_recv_results(struct board_worker *worker, int fpga_num,
+		struct outpkt_results *results)
+{
+	struct spsc_ring *from_device = worker->fpga[fpga_num].from_device;
+	int count = 0;
+	struct pkt *pkt;
+
+	while ( (pkt = spsc_ring_peek(from_device)) ) {
+		if (!outpkt_decode(pkt, results))
+			break;
+		spsc_ring_pop(from_device);
+		board_worker_release(worker, fpga_num, pkt);
+		count++;
+	}
+	return count;
+}
+
+void board_worker_print_stats(struct board_worker *worker)
+{
+	double seconds = (board_worker_time_usec() - worker->start_usec) / 1e6;
+	unsigned long long rt_count = worker->rt_count;
+	unsigned long long bytes = worker->wr_byte_count + worker->rd_byte_count;
+	unsigned long long visit_count = worker->visit_count;
+	unsigned long long skip_count = worker->skip_count;
+	unsigned long long sleep_count = worker->sleep_count;
+
+	fprintf(stderr, "SN %s: %.0f USB round trips/s, %.0f bytes/round trip,"
+		" %llu FPGA visits, %llu skipped, %llu sleeps\n",
+		worker->device->ztex_device->snString,
+		seconds > 0 ? rt_count / seconds : 0,
+		rt_count ? (double)bytes / rt_count : 0,
+		visit_count, skip_count, sleep_count);
+
+	int num;
+	for (num = 0; num < worker->device->num_of_fpgas; num++)
+		fprintf(stderr, "SN %s FPGA #%d: drain %.1f KB/s (%d samples),"
+			" output %.1f KB/s (%d samples)\n",
+			worker->device->ztex_device->snString, num,
+			worker->fpga[num].drain_rate * 1000, worker->fpga[num].drain_samples,
+			worker->fpga[num].output_rate * 1000, worker->fpga[num].output_samples);
+}
@@ -0,0 +1,123 @@
+//===============================================================
+//
+// I/O worker thread per board.
+//
+// * Worker owns the board: USB handle, pkt_comm's of its FPGAs.
+// * Application (scheduler) exchanges packets with the worker
+//   through single-producer single-consumer lock-free rings.
+// * pkt_comm, its pool and received packets are used only
+//   by the worker. Received packets are returned to the worker
+//   with board_worker_release(), the worker deletes them.
+// * Packets sent with board_worker_send() are deleted by the worker.
+//   They can be allocated from the scheduler's pool (memory freed
+//   by the worker goes back to the pool's owner).
+//
+//===============================================================
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define BOARD_WORKER_RING_SIZE	4096
+
+struct outpkt_results;
+
+// Adaptive polling.
+// * FPGA is visited without delay only under backlog: there's data
+//   for it and its input isn't full, or its output had more data
+//   than was read.
+// * If input is full, next visit is when input is expected to
+//   accept more data. That's estimated from the drain rate (bytes
+//   FPGA takes from input, measured between INPUT_PROG_FULL
+//   transitions, lower bound while input isn't full) and the length
+//   of the write that filled the input.
+// * Otherwise next visit is when output is expected, estimated from
+//   read_limit history, but not later than BOARD_WORKER_POLL_MAX_USEC.
+// * Worker sleeps until the earliest visit or until the scheduler
+//   sends data.
+#define BOARD_WORKER_POLL_MIN_USEC	20
+#define BOARD_WORKER_POLL_MAX_USEC	5000
+// Max. number of reads in one FPGA visit
+#define BOARD_WORKER_READS_MAX	4
+// Output rate is measured over that interval
+#define BOARD_WORKER_RATE_INTERVAL_USEC	10000
+
+struct board_worker_fpga {
+	struct spsc_ring *to_device;	// scheduler -> worker, packets for output
+	struct spsc_ring *from_device;	// worker -> scheduler, received packets
+	struct spsc_ring *release;		// scheduler -> worker, packets to delete
+	struct pkt *pending;			// didn't fit into output queue
+	// adaptive polling
+	int input_full;					// last status: input full
+	int output_backlog;				// last read didn't empty output
+	uint64_t next_visit_usec;
+	int full_wait_usec;				// wait before next visit if input is full
+	int last_wr_len;
+	uint64_t drain_start_usec;		// last INPUT_PROG_FULL 1->0 transition
+	uint64_t drain_bytes;			// written since then
+	double drain_rate;				// bytes/usec, 0 if unknown
+	int drain_samples;
+	uint64_t output_start_usec;
+	uint64_t output_bytes;
+	double output_rate;				// bytes/usec
+	int output_samples;
+};
+
+struct board_worker {
+	struct device *device;
+	pthread_t thread;
+	// worker sleeps on the condition, board_worker_send() wakes it up
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	atomic_int sleeping;
+	atomic_int stop;
+	int stopped;
+	atomic_int error;		// worker exits on error
+	struct board_worker_fpga fpga[DEVICE_FPGAS_MAX];
+	// updated by the worker
+	atomic_ullong wr_byte_count, rd_byte_count;
+	atomic_ullong round_count;
+	atomic_ullong rt_count;			// USB round trips (control and bulk transfers)
+	atomic_ullong visit_count;		// FPGA visits
+	atomic_ullong skip_count;		// visits skipped
+	atomic_ullong sleep_count;
+	uint64_t start_usec;
+};
+
+// FPGAs on the device must have pkt_comm. Starts the thread
+struct board_worker *board_worker_new(struct device *device);
+
+// Stops the thread. Does nothing if already stopped
+void board_worker_stop(struct board_worker *worker);
+
+// Stops the thread, deletes packets remaining in rings.
+// Must be called before the device is invalidated
+void board_worker_delete(struct board_worker *worker);
+
+// Returns error that stopped the worker, 0 if it's running
+int board_worker_error(struct board_worker *worker);
+
+// Returns -1 if the ring is full
+int board_worker_send(struct board_worker *worker, int fpga_num, struct pkt *pkt);
+
+// Number of packets that can be sent to the FPGA (the worker
+// only adds space)
+int board_worker_space(struct board_worker *worker, int fpga_num);
+
+// Returns NULL if there are no received packets
+struct pkt *board_worker_recv(struct board_worker *worker, int fpga_num);
+
+// Returns received packet to the worker for deletion
+void board_worker_release(struct board_worker *worker, int fpga_num, struct pkt *pkt);
+
+// Decodes received packets, appends results to the arrays,
+// returns packets to the worker. Stops when there are no received
+// packets or an array is full.
+// Returns number of packets decoded
+int board_worker_recv_results(struct board_worker *worker, int fpga_num,
+		struct outpkt_results *results);
+
+// Prints USB round trips per second, bytes per round trip,
+// estimated FPGA drain and output rates.
+// Worker must be stopped
+void board_worker_print_stats(struct board_worker *worker);
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pkt_comm/pkt_comm.h"
+
+//
+// Checksum microbenchmark.
+// - checks every implementation against byte-by-byte reference
+// - measures checksum, memcpy + checksum and fused copy with checksum
+//
+
+// Byte-by-byte checksum, same as in outpkt_checksum.v
+PKT_CHECKSUM_TYPE checksum_ref(unsigned char *data, int len)
+{
+	PKT_CHECKSUM_TYPE checksum = 0;
+	PKT_CHECKSUM_TYPE checksum_tmp = 0;
+	int checksum_byte_count = 0;
+
+	int i;
+	for (i = 0; i < len; i++) {
+		checksum_tmp |= (PKT_CHECKSUM_TYPE)data[i] << 8 * checksum_byte_count;
+		if (++checksum_byte_count == PKT_CHECKSUM_LEN) {
+			checksum += checksum_tmp;
+			checksum_tmp = 0;
+			checksum_byte_count = 0;
+		}
+	}
+	checksum += checksum_tmp;
+	return ~checksum;
+}
+
+double get_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+const char *impl_name[] = { "auto", "scalar", "sse2", "avx2" };
+
+const int sizes[] = { 14, 64, 1024, 8192, 65536 };
+
+#define TOTAL_BYTES	(256 * 1024 * 1024)
+
+int main()
+{
+	int buf_size = 2 * 65536 + 64;
+	unsigned char *src = malloc(buf_size);
+	unsigned char *dst = malloc(buf_size);
+	int i, impl;
+	size_t j;
+	for (i = 0; i < buf_size; i++)
+		src[i] = random();
+
+	for (impl = PKT_CHECKSUM_IMPL_SCALAR; impl <= PKT_CHECKSUM_IMPL_AVX2; impl++) {
+		if (pkt_checksum_set_impl(impl) < 0) {
+			printf("%s: not supported\n", impl_name[impl]);
+			continue;
+		}
+
+		for (i = 0; i < 100000; i++) {
+			int offset = random() % 64;
+			int len = random() % (i < 1000 ? 65536 : 300);
+			PKT_CHECKSUM_TYPE checksum = checksum_ref(src + offset, len);
+			memset(dst, 0, len);
+			if (pkt_checksum(NULL, src + offset, len) != checksum
+					|| pkt_checksum_copy(dst, src + offset, len) != checksum
+					|| memcmp(dst, src + offset, len) ) {
+				printf("%s: mismatch, offset %d len %d\n",
+						impl_name[impl], offset, len);
+				return 1;
+			}
+		}
+
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			int len = sizes[j];
+			int count = TOTAL_BYTES / len;
+			volatile PKT_CHECKSUM_TYPE result;
+
+			double t0 = get_time();
+			for (i = 0; i < count; i++)
+				result = checksum_ref(src + i % 64, len);
+			double t1 = get_time();
+			for (i = 0; i < count; i++)
+				result = pkt_checksum(NULL, src + i % 64, len);
+			double t2 = get_time();
+			for (i = 0; i < count; i++) {
+				memcpy(dst, src + i % 64, len);
+				result = pkt_checksum(NULL, dst, len);
+			}
+			double t3 = get_time();
+			for (i = 0; i < count; i++)
+				result = pkt_checksum_copy(dst, src + i % 64, len);
+			double t4 = get_time();
+
+			(void)result;
+			printf("%-6s len %6d: reference %6.0f MB/s, checksum %6.0f MB/s,"
+				" memcpy+checksum %6.0f MB/s, copy+checksum %6.0f MB/s\n",
+				impl_name[impl], len, TOTAL_BYTES / (t1 - t0) / 1e6,
+				TOTAL_BYTES / (t2 - t1) / 1e6, TOTAL_BYTES / (t3 - t2) / 1e6,
+				TOTAL_BYTES / (t4 - t3) / 1e6);
+		}
+	}
+
+	return 0;
+}
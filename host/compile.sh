@@ -1,4 +1,7 @@
 #gcc ztex.c inouttraffic.c pkt_comm/pkt_comm.c simple_test.c -osimple_test -lusb-1.0
 #gcc ztex.c inouttraffic.c ztex_scan.c pkt_comm/pkt_comm.c test.c -otest -lusb-1.0
 #gcc ztex.c inouttraffic.c ztex_scan.c pkt_comm/*.o pkt_test.c -opkt_test -lusb-1.0
-gcc ztex.c inouttraffic.c ztex_scan.c pkt_comm/*.o descrypt_test.c -odescrypt_test -lusb-1.0
+gcc ztex.c inouttraffic.c ztex_scan.c spsc_ring.c board_worker.c des_bs.c keyspace.c hybrid.c job.c work_queue.c pkt_comm/*.o descrypt_test.c -odescrypt_test -lusb-1.0 -lpthread
+#gcc ztex.c inouttraffic.c ztex_scan.c spsc_ring.c board_worker.c des_bs.c keyspace.c hybrid.c job.c work_queue.c emulator.c pkt_comm/*.o descrypt_test.c -odescrypt_test_emu -lpthread -lcrypt
+#gcc -O2 pkt_comm/*.o checksum_bench.c -ochecksum_bench
+#gcc -O2 des_bs.c des_bs_bench.c -odes_bs_bench -lcrypt
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pkt_comm/pkt_comm.h"
+#include "pkt_comm/cmp_config.h"
+#include "des_bs.h"
+
+// DES S-boxes, arranged for bitsliced evaluation.
+// S-box input bits 1..6 (1 is MSB): row is bits 1,6; column is bits 2..5.
+// Upper 4 bits select one of 16 entries. Entry is the truth table
+// of output bit (1st is MSB) as a function of input bits 5,6:
+// bit (2 * bit5 + bit6) is set if the output bit is 1.
+static const unsigned char des_bs_sbox_fn[8][4][16] = {
+	{
+		{  9, 1, 6, 7, 6,14, 6, 8,10, 7, 9, 4,13, 9, 6, 8 },
+		{ 13,11, 6, 2, 8, 7, 9, 4,11, 1, 7, 8, 7,12, 0,11 },
+		{  9, 2,15, 1,15, 9, 0, 6, 2, 9, 4,13, 9,14, 7, 2 },
+		{  8, 7, 4,11, 1, 8,15, 6, 6, 0, 9,14,11, 7, 1, 9 }
+	},
+	{
+		{  9, 5, 6,10, 3,12, 9, 6,14, 6, 9, 1, 6, 9, 1,14 },
+		{  9,14, 3,12, 6, 4, 3, 9, 6, 1,12, 3, 9,15, 8, 6 },
+		{  3,12,15, 9, 4, 9, 2, 6, 4, 7,11, 8,10, 6, 4, 7 },
+		{ 15, 8, 6, 1, 5, 6, 8,11, 2,13,10, 5, 3, 2,13,12 }
+	},
+	{
+		{  3,13, 0, 9,12, 9,11, 6, 9, 6,13, 2, 9, 6, 6, 9 },
+		{ 10, 4, 9, 7, 4,15, 6, 2, 5, 3, 6, 8,10, 6, 9,13 },
+		{  9, 4, 7,11, 2,12, 9, 3,12, 0, 6, 9, 9,11, 6, 7 },
+		{ 10, 9, 6, 5, 5, 6, 9,10, 3, 6,12, 9,13, 8,11, 4 }
+	},
+	{
+		{ 14, 3, 8, 5, 0, 9,13,14, 9, 1, 7,14, 3,12, 2, 9 },
+		{  7, 9,14, 0,10,12, 4, 7,12, 8, 1, 7, 9, 6,11,12 },
+		{  1, 7,14,12,12, 2, 9, 6,15, 8, 6, 1, 1,13,12,10 },
+		{  7,14, 8, 9, 9, 4, 3,12,10, 1,12, 7, 7,11, 9, 0 }
+	},
+	{
+		{ 14, 8, 4, 3, 1,14, 9, 7,10, 6,13,12,13, 9, 2, 4 },
+		{  6, 9,11, 6, 6, 6, 1, 9, 1,10,12, 9,11, 5, 9, 6 },
+		{ 11, 2,13, 5, 0,15, 2, 9, 6,12, 9, 3,11, 0, 7,12 },
+		{  8, 4, 9,11, 6, 7,11, 4, 2,13, 6, 9,13,12, 4,10 }
+	},
+	{
+		{ 11, 5, 9, 6, 4,10, 9,12, 5, 9, 6,11,10, 4, 4,11 },
+		{  9, 6,10, 9, 6,14, 5, 1, 6,13, 8, 3, 9, 9, 6,12 },
+		{ 10,13, 6, 1, 2, 9,13, 6,12, 3, 1,14,11,12, 2, 5 },
+		{ 12, 4, 3,10,12, 3,12, 7, 9, 5,10, 6, 3,10, 5, 9 }
+	},
+	{
+		{  6, 6, 9,13, 6, 9,12, 2, 8,15, 1, 6, 7,12, 2, 9 },
+		{  3,12, 3, 4, 6,14, 9, 9, 6, 6, 9,13,12, 9, 6, 8 },
+		{  4,15, 1, 8,11, 4,14, 9,10, 1, 4,15, 5, 9,10, 6 },
+		{  6,10, 9, 6, 9, 7, 9, 4, 9, 7, 6, 9,14, 8, 4, 3 }
+	},
+	{
+		{  9,11, 6, 1, 7,12, 8, 3, 4, 2,13,11,10, 7, 1,12 },
+		{  9, 6, 5,10,10, 6, 9, 5, 1,11, 6, 9,14, 4, 9, 3 },
+		{ 12, 0,15, 3, 1,15, 8,12, 7,10, 8, 5, 6, 1, 7,10 },
+		{ 11, 2,12, 7,12, 9, 1, 6,13,12, 1, 8, 2, 6,15, 9 }
+	}
+};
+
+// Inverse of P permutation: S-box output bit -> bit of f()
+static const unsigned char des_bs_p[32] = {
+	 8,16,22,30,12,27, 1,17,23,15,29, 5,25,19, 9, 0,
+	 7,13,24, 2, 3,28,10,18,31,11,21, 6, 4,26,14,20
+};
+
+static const unsigned char des_pc1[56] = {
+	57,49,41,33,25,17, 9, 1,58,50,42,34,26,18,
+	10, 2,59,51,43,35,27,19,11, 3,60,52,44,36,
+	63,55,47,39,31,23,15, 7,62,54,46,38,30,22,
+	14, 6,61,53,45,37,29,21,13, 5,28,20,12, 4
+};
+
+static const unsigned char des_pc2[48] = {
+	14,17,11,24, 1, 5, 3,28,15, 6,21,10,
+	23,19,12, 4,26, 8,16, 7,27,20,13, 2,
+	41,52,31,37,47,55,30,40,51,45,33,48,
+	44,49,39,56,34,53,46,42,50,36,29,32
+};
+
+static const unsigned char des_shifts[16] = {
+	1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1
+};
+
+static const unsigned char des_fp[64] = {
+	40, 8,48,16,56,24,64,32,39, 7,47,15,55,23,63,31,
+	38, 6,46,14,54,22,62,30,37, 5,45,13,53,21,61,29,
+	36, 4,44,12,52,20,60,28,35, 3,43,11,51,19,59,27,
+	34, 2,42,10,50,18,58,26,33, 1,41, 9,49,17,57,25
+};
+
+static const char des_ascii64[] =
+	"./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+// Values of des_ascii64 chars, 64 if the char isn't in the alphabet
+static const unsigned char des_ascii64_value[256] = {
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64, 0, 1,
+	 2, 3, 4, 5, 6, 7, 8, 9,10,11,64,64,64,64,64,64,
+	64,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,
+	27,28,29,30,31,32,33,34,35,36,37,64,64,64,64,64,
+	64,38,39,40,41,42,43,44,45,46,47,48,49,50,51,52,
+	53,54,55,56,57,58,59,60,61,62,63,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+	64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64
+};
+
+// 6-bit values with reversed bit order (1st bit of the char is MSB,
+// 1st bit of the hash is LSB)
+static const unsigned char des_rev6[64] = {
+	 0,32,16,48, 8,40,24,56, 4,36,20,52,12,44,28,60,
+	 2,34,18,50,10,42,26,58, 6,38,22,54,14,46,30,62,
+	 1,33,17,49, 9,41,25,57, 5,37,21,53,13,45,29,61,
+	 3,35,19,51,11,43,27,59, 7,39,23,55,15,47,31,63
+};
+
+
+// =======================================================================
+//
+// Implementations
+//
+// =======================================================================
+
+typedef void (*des_bs_core_fn)(struct des_bs *bs);
+
+#define DES_BS_VEC		uint64_t
+#define DES_BS_CORE		des_bs_core_scalar
+#define DES_BS_TARGET
+#include "des_bs_core.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DES_BS_X86
+
+typedef uint64_t des_bs_vec128 __attribute__((vector_size(16)));
+typedef uint64_t des_bs_vec256 __attribute__((vector_size(32)));
+typedef uint64_t des_bs_vec512 __attribute__((vector_size(64)));
+
+#define DES_BS_VEC		des_bs_vec128
+#define DES_BS_CORE		des_bs_core_sse2
+#define DES_BS_TARGET	__attribute__((target("sse2")))
+#include "des_bs_core.h"
+
+#define DES_BS_VEC		des_bs_vec256
+#define DES_BS_CORE		des_bs_core_avx2
+#define DES_BS_TARGET	__attribute__((target("avx2")))
+#include "des_bs_core.h"
+
+#define DES_BS_VEC		des_bs_vec512
+#define DES_BS_CORE		des_bs_core_avx512
+#define DES_BS_TARGET	__attribute__((target("avx512f")))
+#include "des_bs_core.h"
+#endif
+
+static des_bs_core_fn des_bs_core_ptr;
+static int des_bs_words;
+
+int des_bs_set_impl(int impl)
+{
+	des_bs_core_fn fn = NULL;
+	int words = 1;
+
+#ifdef DES_BS_X86
+	__builtin_cpu_init();
+	if (impl == DES_BS_IMPL_AUTO)
+		impl = __builtin_cpu_supports("avx512f") ? DES_BS_IMPL_AVX512
+			: __builtin_cpu_supports("avx2") ? DES_BS_IMPL_AVX2
+			: __builtin_cpu_supports("sse2") ? DES_BS_IMPL_SSE2
+			: DES_BS_IMPL_SCALAR;
+
+	if (impl == DES_BS_IMPL_AVX512 && __builtin_cpu_supports("avx512f")) {
+		fn = des_bs_core_avx512;
+		words = 8;
+	}
+	else if (impl == DES_BS_IMPL_AVX2 && __builtin_cpu_supports("avx2")) {
+		fn = des_bs_core_avx2;
+		words = 4;
+	}
+	else if (impl == DES_BS_IMPL_SSE2 && __builtin_cpu_supports("sse2")) {
+		fn = des_bs_core_sse2;
+		words = 2;
+	}
+#else
+	if (impl == DES_BS_IMPL_AUTO)
+		impl = DES_BS_IMPL_SCALAR;
+#endif
+	if (impl == DES_BS_IMPL_SCALAR)
+		fn = des_bs_core_scalar;
+
+	if (!fn)
+		return -1;
+	// Not expected to change while there are computations
+	des_bs_core_ptr = fn;
+	des_bs_words = words;
+	return impl;
+}
+
+int des_bs_get_depth()
+{
+	if (!des_bs_core_ptr)
+		des_bs_set_impl(DES_BS_IMPL_AUTO);
+	return 64 * des_bs_words;
+}
+
+
+// =======================================================================
+//
+// Tables
+//
+// =======================================================================
+
+void des_bs_set_salt(struct des_bs *bs, int salt)
+{
+	int i;
+	bs->salt = salt;
+	// E expansion: bits 1..6 of S-box input are R bits 4s-1 .. 4s+4
+	for (i = 0; i < 48; i++)
+		bs->e[i] = (i / 6 * 4 + i % 6 + 31) % 32;
+	// Salt bit i swaps expansion bits i and i + 24
+	for (i = 0; i < 12; i++)
+		if (salt & (1 << i)) {
+			unsigned char tmp = bs->e[i];
+			bs->e[i] = bs->e[i + 24];
+			bs->e[i + 24] = tmp;
+		}
+}
+
+static void des_bs_init_tables(struct des_bs *bs)
+{
+	int round, shift = 0;
+	int i;
+
+	// Key schedule: C, D halves are rotated, round key is taken with PC2
+	for (round = 0; round < 16; round++) {
+		shift += des_shifts[round];
+		for (i = 0; i < 48; i++) {
+			int cd = des_pc2[i] - 1;
+			cd = cd < 28 ? (cd + shift) % 28 : 28 + (cd - 28 + shift) % 28;
+			bs->ks[round][i] = des_pc1[cd] - 1;
+		}
+	}
+}
+
+struct des_bs *des_bs_new(int salt)
+{
+	struct des_bs *bs = malloc(sizeof(struct des_bs));
+	if (!bs) {
+		fprintf(stderr, "des_bs_new(): unable to allocate %d bytes\n",
+				(int)sizeof(struct des_bs));
+		return NULL;
+	}
+
+	int size = 64 * DES_BS_WORDS_MAX * sizeof(uint64_t);
+	if (posix_memalign((void **)&bs->k, 64, size)) {
+		fprintf(stderr, "des_bs_new(): unable to allocate %d bytes\n", size);
+		free(bs);
+		return NULL;
+	}
+	if (posix_memalign((void **)&bs->block, 64, size)) {
+		fprintf(stderr, "des_bs_new(): unable to allocate %d bytes\n", size);
+		free(bs->k);
+		free(bs);
+		return NULL;
+	}
+
+	bs->depth = des_bs_get_depth();
+	des_bs_init_tables(bs);
+	des_bs_set_salt(bs, salt);
+	return bs;
+}
+
+void des_bs_delete(struct des_bs *bs)
+{
+	free(bs->k);
+	free(bs->block);
+	free(bs);
+}
+
+
+// =======================================================================
+//
+// Computation
+//
+// =======================================================================
+
+// 64x64 bit matrix: bit c of a[r] goes to bit r of a[c]
+static void des_bs_transpose(uint64_t *a)
+{
+	uint64_t m = 0x00000000FFFFFFFFULL;
+	int j, k;
+	for (j = 32; j; j >>= 1, m ^= m << j)
+		for (k = 0; k < 64; k = (k + j + 1) & ~j) {
+			uint64_t t = ((a[k] >> j) ^ a[k + j]) & m;
+			a[k] ^= t << j;
+			a[k + j] ^= t;
+		}
+}
+
+void des_bs_crypt(struct des_bs *bs, unsigned char *keys, int num_keys,
+		uint64_t *hashes)
+{
+	uint64_t a[64];
+	int words = des_bs_words;
+	int w, i, j;
+
+	bs->depth = des_bs_get_depth();
+	if (num_keys > bs->depth)
+		num_keys = bs->depth;
+
+	// DES key bit n (1st bit is LSB here) is bit 7-n%8 of key byte n/8,
+	// 7-bit chars are shifted left by 1, parity bits are not used
+	for (w = 0; w < words; w++) {
+		for (i = 0; i < 64; i++) {
+			int key_num = w * 64 + i;
+			uint64_t key_bits = 0;
+			if (key_num < num_keys)
+				for (j = 0; j < DES_BS_KEY_LEN; j++) {
+					unsigned char c = keys[key_num * DES_BS_KEY_LEN + j];
+					key_bits |= (uint64_t)(c << 1 & 0xFE) << (j * 8);
+				}
+			// reverse bits in each byte
+			key_bits = (key_bits & 0x0F0F0F0F0F0F0F0FULL) << 4
+				| (key_bits >> 4 & 0x0F0F0F0F0F0F0F0FULL);
+			key_bits = (key_bits & 0x3333333333333333ULL) << 2
+				| (key_bits >> 2 & 0x3333333333333333ULL);
+			key_bits = (key_bits & 0x5555555555555555ULL) << 1
+				| (key_bits >> 1 & 0x5555555555555555ULL);
+			a[i] = key_bits;
+		}
+		des_bs_transpose(a);
+		for (i = 0; i < 64; i++)
+			bs->k[i * words + w] = a[i];
+	}
+
+	des_bs_core_ptr(bs);
+
+	// Final permutation, back to one hash per key
+	for (w = 0; w * 64 < num_keys; w++) {
+		for (i = 0; i < 64; i++)
+			a[i] = bs->block[(des_fp[i] - 1) * words + w];
+		des_bs_transpose(a);
+		for (i = 0; i < 64 && w * 64 + i < num_keys; i++)
+			hashes[w * 64 + i] = a[i];
+	}
+}
+
+uint64_t des_bs_crypt_one(struct des_bs *bs, unsigned char *key)
+{
+	uint64_t hash;
+	des_bs_crypt(bs, key, 1, &hash);
+	return hash;
+}
+
+void des_bs_encode(int salt, uint64_t hash, char *out)
+{
+	int i;
+	out[0] = des_ascii64[salt & 0x3f];
+	out[1] = des_ascii64[salt >> 6 & 0x3f];
+	// 6-bit chars; last char has 2 zero bits
+	for (i = 0; i < 11; i++)
+		out[2 + i] = des_ascii64[ des_rev6[hash >> (i * 6) & 0x3f] ];
+	out[13] = 0;
+}
+
+int des_bs_decode(char *in, int *salt, uint64_t *hash)
+{
+	const unsigned char *str = (const unsigned char *)in;
+	unsigned char value[13];
+	int i, invalid = 0;
+	// No branches per char, invalid chars are checked at once
+	for (i = 0; i < 13; i++) {
+		value[i] = des_ascii64_value[ str[i] ];
+		invalid |= value[i];
+	}
+	// last char has 2 zero bits
+	if (invalid & 64 || value[12] & 3)
+		return -1;
+
+	*salt = value[0] | value[1] << 6;
+	uint64_t result = 0;
+	for (i = 0; i < 11; i++)
+		result |= (uint64_t)des_rev6[ value[2 + i] ] << (i * 6);
+	*hash = result;
+	return 0;
+}
+
+uint64_t des_bs_cmp_hash(struct cmp_hash *cmp_hash)
+{
+	uint64_t hash = 0;
+	int i;
+	for (i = CMP_CONFIG_HASH_LEN - 1; i >= 0; i--)
+		hash = hash << 8 | cmp_hash->b[i];
+	return hash;
+}
+
+int des_bs_cmp_search(struct cmp_config *cmp_config, uint64_t hash)
+{
+	int lo = 0, hi = cmp_config->num_hashes - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		uint64_t value = des_bs_cmp_hash(&cmp_config->cmp_hash[mid]);
+		if (value == hash)
+			return mid;
+		if (value < hash)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+int des_bs_verify(struct des_bs *bs, struct cmp_config *cmp_config,
+		unsigned char *key, int hash_num)
+{
+	if (hash_num < 0 || hash_num >= cmp_config->num_hashes)
+		return 0;
+	if (bs->salt != cmp_config->salt)
+		des_bs_set_salt(bs, cmp_config->salt);
+	return des_bs_crypt_one(bs, key)
+		== des_bs_cmp_hash(&cmp_config->cmp_hash[hash_num]);
+}
@@ -0,0 +1,83 @@
+//===============================================================
+//
+// Bitsliced traditional DES crypt(3), same as computed by
+// descrypt cores.
+//
+// * Each bit of a vector belongs to a separate key. Vector width
+//   (keys per batch) depends on implementation: 64 (scalar),
+//   128 (SSE2), 256 (AVX2), 512 (AVX-512).
+// * Keys are 8 chars, 7 bits used, padded with 0 (same as
+//   candidates from word_gen).
+// * Salt is 12-bit, same as cmp_config.salt.
+// * Hashes are 64-bit DES output, 1st bit of the output is LSB.
+//   Same as cmp_config.cmp_hash read as little-endian value.
+//
+// Usage: verification of CMP_EQUAL results, computation without
+// boards, throughput comparisons (des_bs_bench.c).
+//
+//===============================================================
+
+#include <stdint.h>
+
+#define DES_BS_KEY_LEN	8
+
+// Implementations. Best available one is selected on first use.
+#define DES_BS_IMPL_AUTO	0
+#define DES_BS_IMPL_SCALAR	1
+#define DES_BS_IMPL_SSE2	2
+#define DES_BS_IMPL_AVX2	3
+#define DES_BS_IMPL_AVX512	4
+
+// 64-bit words per vector, max.
+#define DES_BS_WORDS_MAX	8
+#define DES_BS_DEPTH_MAX	(64 * DES_BS_WORDS_MAX)
+
+struct des_bs {
+	int salt;
+	int depth;				// keys per batch for current implementation
+	unsigned char e[48];	// E expansion modified by salt
+	unsigned char ks[16][48];	// key bit numbers for each round
+	// aligned, DES_BS_WORDS_MAX words per vector
+	uint64_t *k;			// 64 key bits
+	uint64_t *block;		// 64 bits of L and R
+};
+
+// Selects implementation, it's used by all instances.
+// Returns selected implementation or -1 if it's not supported
+int des_bs_set_impl(int impl);
+
+// Returns number of keys computed in one batch
+int des_bs_get_depth();
+
+struct des_bs *des_bs_new(int salt);
+
+void des_bs_delete(struct des_bs *bs);
+
+void des_bs_set_salt(struct des_bs *bs, int salt);
+
+// Computes hashes for 'num_keys' keys (up to des_bs_get_depth()),
+// each key is DES_BS_KEY_LEN bytes
+void des_bs_crypt(struct des_bs *bs, unsigned char *keys, int num_keys,
+		uint64_t *hashes);
+
+// Computes hash of a single key
+uint64_t des_bs_crypt_one(struct des_bs *bs, unsigned char *key);
+
+// Encodes as crypt(3) string (13 chars and terminating 0)
+void des_bs_encode(int salt, uint64_t hash, char *out);
+
+// Decodes crypt(3) string (13 chars, terminating 0 isn't required).
+// Returns -1 if the string isn't a valid traditional DES hash
+int des_bs_decode(char *in, int *salt, uint64_t *hash);
+
+// Hash value from cmp_config
+uint64_t des_bs_cmp_hash(struct cmp_hash *cmp_hash);
+
+// Binary search in cmp_config (hashes are sorted in ascending order).
+// Returns hash number or -1
+int des_bs_cmp_search(struct cmp_config *cmp_config, uint64_t hash);
+
+// Checks if the key produces cmp_config hash number 'hash_num'.
+// Salt is taken from cmp_config
+int des_bs_verify(struct des_bs *bs, struct cmp_config *cmp_config,
+		unsigned char *key, int hash_num);
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <crypt.h>
+
+#include "pkt_comm/pkt_comm.h"
+#include "pkt_comm/cmp_config.h"
+#include "des_bs.h"
+
+//
+// Bitsliced DES microbenchmark.
+// - checks every implementation against crypt(3)
+// - measures keys/s on a single thread
+//
+
+double get_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+const char *impl_name[] = { "auto", "scalar", "sse2", "avx2", "avx512" };
+
+#define TEST_KEYS	2000
+#define BENCH_SEC	2
+
+int main()
+{
+	static unsigned char keys[DES_BS_DEPTH_MAX * DES_BS_KEY_LEN];
+	static uint64_t hashes[DES_BS_DEPTH_MAX];
+	struct crypt_data crypt_data;
+	char setting[14], encoded[14], key_str[DES_BS_KEY_LEN + 1];
+	int impl, i, j;
+
+	memset(&crypt_data, 0, sizeof(crypt_data));
+
+	for (impl = DES_BS_IMPL_SCALAR; impl <= DES_BS_IMPL_AVX512; impl++) {
+		if (des_bs_set_impl(impl) < 0) {
+			printf("%s: not supported\n", impl_name[impl]);
+			continue;
+		}
+		int depth = des_bs_get_depth();
+		int salt = random() & 0xfff;
+		struct des_bs *bs = des_bs_new(salt);
+		if (!bs)
+			return 1;
+
+		int tested = 0;
+		while (tested < TEST_KEYS) {
+			for (i = 0; i < depth; i++) {
+				int len = random() % (DES_BS_KEY_LEN + 1);
+				for (j = 0; j < DES_BS_KEY_LEN; j++)
+					keys[i * DES_BS_KEY_LEN + j] = j < len ? 1 + random() % 127 : 0;
+			}
+			des_bs_crypt(bs, keys, depth, hashes);
+
+			des_bs_encode(salt, 0, setting);
+			setting[2] = 0;
+			for (i = 0; i < depth; i++, tested++) {
+				memcpy(key_str, keys + i * DES_BS_KEY_LEN, DES_BS_KEY_LEN);
+				key_str[DES_BS_KEY_LEN] = 0;
+				char *result = crypt_r(key_str, setting, &crypt_data);
+				des_bs_encode(salt, hashes[i], encoded);
+				if (!result || strcmp(result, encoded)) {
+					printf("%s: mismatch, key \"%s\" salt %s: %s, expected %s\n",
+						impl_name[impl], key_str, setting, encoded,
+						result ? result : "(null)");
+					return 1;
+				}
+			}
+			des_bs_set_salt(bs, salt = random() & 0xfff);
+		}
+
+		int count = 0;
+		double t0 = get_time(), t1;
+		do {
+			des_bs_crypt(bs, keys, depth, hashes);
+			count += depth;
+			t1 = get_time();
+		} while (t1 - t0 < BENCH_SEC);
+
+		printf("%-6s depth %3d: %8.0f keys/s\n", impl_name[impl], depth,
+				count / (t1 - t0));
+		des_bs_delete(bs);
+	}
+
+	return 0;
+}
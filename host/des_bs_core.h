@@ -0,0 +1,77 @@
+//
+// DES core for the given vector type, included from des_bs.c with:
+// DES_BS_VEC - vector type
+// DES_BS_CORE - function name
+// DES_BS_TARGET - function attributes
+//
+// Computes 25 iterations of salted DES of zero block
+// from bs->k into bs->block (L, R before FP)
+//
+
+DES_BS_TARGET
+static void DES_BS_CORE(struct des_bs *bs)
+{
+	DES_BS_VEC *k = (DES_BS_VEC *)bs->k;
+	DES_BS_VEC *block = (DES_BS_VEC *)bs->block;
+	DES_BS_VEC *l = block, *r = block + 32, *tmp;
+	DES_BS_VEC zero = (DES_BS_VEC){ 0 };
+	int iter, round, s, b, i;
+
+	for (i = 0; i < 64; i++)
+		block[i] = zero;
+
+	for (iter = 0; iter < 25; iter++) {
+		for (round = 0; round < 16; round++) {
+			unsigned char *ks = bs->ks[round];
+
+#pragma GCC unroll 8
+			for (s = 0; s < 8; s++) {
+				DES_BS_VEC x[6], m[4], f[16], v[8];
+#pragma GCC unroll 6
+				for (i = 0; i < 6; i++)
+					x[i] = r[ bs->e[s*6 + i] ] ^ k[ ks[s*6 + i] ];
+
+				// All functions of 2 lower input bits
+				m[0] = ~x[4] & ~x[5];
+				m[1] = ~x[4] & x[5];
+				m[2] = x[4] & ~x[5];
+				m[3] = x[4] & x[5];
+				f[0] = zero;
+#pragma GCC unroll 16
+				for (i = 1; i < 16; i++)
+					f[i] = f[i & (i - 1)] | m[__builtin_ctz(i)];
+
+				// Select with upper input bits
+#pragma GCC unroll 4
+				for (b = 0; b < 4; b++) {
+					const unsigned char *fn = des_bs_sbox_fn[s][b];
+#pragma GCC unroll 8
+					for (i = 0; i < 8; i++)
+						v[i] = f[fn[2*i]] ^ ((f[fn[2*i]] ^ f[fn[2*i + 1]]) & x[3]);
+#pragma GCC unroll 4
+					for (i = 0; i < 4; i++)
+						v[i] = v[2*i] ^ ((v[2*i] ^ v[2*i + 1]) & x[2]);
+#pragma GCC unroll 2
+					for (i = 0; i < 2; i++)
+						v[i] = v[2*i] ^ ((v[2*i] ^ v[2*i + 1]) & x[1]);
+					l[ des_bs_p[s*4 + b] ] ^= v[0] ^ ((v[0] ^ v[1]) & x[0]);
+				}
+			}
+			tmp = l; l = r; r = tmp;
+		}
+		// no swap after round 16: next iteration starts with R16, L16
+		tmp = l; l = r; r = tmp;
+	}
+
+	// Output block is R16, L16 of the last iteration (now in l, r)
+	if (l != block)
+		for (i = 0; i < 32; i++) {
+			DES_BS_VEC t = block[i];
+			block[i] = block[32 + i];
+			block[32 + i] = t;
+		}
+}
+
+#undef DES_BS_VEC
+#undef DES_BS_CORE
+#undef DES_BS_TARGET
@@ -15,6 +15,17 @@
 #include "pkt_comm/word_list.h"
 #include "pkt_comm/word_gen.h"
 #include "pkt_comm/cmp_config.h"
+#include "pkt_comm/outpkt.h"
+#include "pkt_comm/candidate.h"
+#include "pkt_comm/mask.h"
+
+#include "spsc_ring.h"
+#include "board_worker.h"
+#include "des_bs.h"
+#include "work_queue.h"
+#include "keyspace.h"
+#include "job.h"
+#include "hybrid.h"
 
 const int BUF_SIZE_MAX = 32768;
 
@@ -34,11 +45,10 @@ void set_random()
 }
 
 
-struct pkt_comm_params params = { 2, 16384, 32766 };
+struct pkt_comm_params params = { 2, 16384, 32766, 0 };
 
 int device_init_fpgas(struct device *device)
 {
-	int result;
 	int i;
 	for (i = 0; i < device->num_of_fpgas; i++) {
 		struct fpga *fpga = &device->fpga[i];
@@ -146,180 +156,66 @@ struct device_list *device_init_scan()
 
 unsigned long long wr_byte_count = 0, rd_byte_count = 0;
 
-int device_fpgas_pkt_rw(struct device *device)
-{
-	int result;
-	int num;
-	for (num = 0; num < device->num_of_fpgas; num++) {
-		
-		struct fpga *fpga = &device->fpga[num];
-		//if (!fpga->valid) // currently if r/w error on some FPGA, the entire device invalidated
-		//	continue;
-
-		//fpga_select(fpga); // unlike select_fpga() from Ztex SDK, it waits for i/o timeout
-		result = fpga_select_setup_io(fpga); // combines fpga_select(), fpga_get_io_state() and fpga_setup_output() in 1 USB request
-		if (result < 0) {
-			fprintf(stderr, "SN %s FPGA #%d fpga_select_setup_io() error: %d\n",
-				device->ztex_device->snString, num, result);
-			return result;
-		}
-
-		if (fpga->wr.io_state.pkt_comm_status) {
-			fprintf(stderr, "SN %s FPGA #%d error: pkt_comm_status=0x%02x\n",
-				device->ztex_device->snString, num, fpga->wr.io_state.pkt_comm_status);
-			return -1;
-		}
-
-		if (fpga->wr.io_state.app_status) {
-			fprintf(stderr, "SN %s FPGA #%d error: app_status=0x%02x\n",
-				device->ztex_device->snString, num, fpga->wr.io_state.app_status);
-			return -1;
-		}
-
-		result = fpga_pkt_write(fpga);
-		if (result < 0) {
-			fprintf(stderr, "SN %s FPGA #%d write error: %d (%s)\n",
-				device->ztex_device->snString, num, result, libusb_strerror(result));
-			//fpga->valid = 0;
-			return result; // on such a result, device invalidated
-		}
-		if (result > 0) {
-			wr_byte_count += result;
-			if ( wr_byte_count/1024/1024 != (wr_byte_count - result)/1024/1024 ) {
-				//printf(".");
-				//fflush(stdout);
-			}
-		}
-
-		// read
-		result = fpga_pkt_read(fpga);
-		if (result < 0) {
-			fprintf(stderr, "SN %s FPGA #%d read error: %d (%s)\n",
-				device->ztex_device->snString, num, result, libusb_strerror(result));
-			//fpga->valid = 0;
-			return result; // on such a result, device invalidated
-		}
-		if (result > 0)
-			rd_byte_count += result; //fpga->rd.read_limit;
-
-	} // for( ;num_of_fpgas ;)
-	return 1;
-}
-
 //////////////////////////////////////////////////////////////////////////////
 
 
-// *****************************************
-//
-// *** Sort hashes in ascending order!!! ***
-//
-// *****************************************
+// Hashes with salt "55", used if hash file isn't given.
+// Word list test runs with the group that has that salt
+
+char *hashes[] = {
+	"55.lb74tLg6G.", // myabc101
+	"558pslO4L.OjU", // myabc130
+	"55qDu3VDtua/E", // myabc120
+	"554l8LHpz.cWk", // myzzz020
+	"55xEPkoviI53k", // myabc100
+
+	"55pT/rvhQp2v6", // myabc877
+	"552gyDvTXpkxc", // myab876
+	"55XMXhtdxD3EM", // myaaa000
+	"55OAIiEGouUQM", // my**333
+	"55P6xmsmw0NTs", // myabc876
+
+	"55rkdNiSq9SU2", // 2005000
+	"55FKqA47k5umY", // 0005000
+	"55ZoyerAEn6OY", // 7440442
+	"55FxkOELVhKSY", // 5555999
+	"55GiCdrvSK7hY", // 2555991
+
+	"55DCFZ9SeXAtI", // mypwd938
+	"55hMnVAwQjWXI", // mypwd123
+	"55u/GjqFTql0o", // my***333
+	"55b0yjlm8a.qg", // my777
+	"55K2Ia8nAPszg", // mypwd512
+
+	"55olM.2D3SjWQ", // mypwd999
+	"55BQzX4fO/nmQ", // myzzz999
+	"55p0buF22eneQ", // myzzz015
+	"559KXUJaX11Zw", // myzzz019
+	"55W5E84i5X35w", // mypwd000
+	NULL };
 
-struct cmp_config cmp_55_my = {
-	0x01c7, // salt: ASCII "55"
-	50, // 50 hashes (25 known)
-	{
-		{ 0xc0, 0x98, 0x93, 0xd8, 0xa9, 0x37, 0x84, 0x04 }, // myabc101
-		{ 0xd4, 0x7a, 0x8c, 0x16, 0xa6, 0x03, 0x56, 0x1f }, // myabc130
-		{ 0x1b, 0x7f, 0xa1, 0x21, 0x7f, 0x5e, 0x19, 0x28 }, // myabc120
-		{ 0xd8, 0x48, 0xe9, 0xf2, 0xfa, 0x03, 0x45, 0x34 }, // myzzz020
-		{ 0xaf, 0x60, 0x0f, 0xcb, 0xdd, 0x29, 0x38, 0x3a }, // myabc100
-
-		{ 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x00, 0x40 },
-		{ 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x00, 0x40 },
-		{ 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x00, 0x40 },
-		{ 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x00, 0x40 },
-		{ 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x00, 0x40 },
-
-		{ 0xab, 0x0f, 0xee, 0x77, 0xeb, 0xac, 0xc8, 0x4d }, // myabc877
-		{ 0x48, 0xf3, 0xf1, 0xb7, 0x1f, 0xaf, 0xc3, 0x5b }, // myab876
-		{ 0xb1, 0x11, 0xb7, 0x67, 0xf9, 0xf2, 0xa8, 0x60 }, // myaaa000
-		{ 0x16, 0xa3, 0x74, 0x82, 0xb4, 0x5c, 0x81, 0x63 }, // my**333
-		{ 0x36, 0xf1, 0x4e, 0xc7, 0xf4, 0x40, 0xa6, 0x7f }, // myabc876
-		
-		{ 0xfb, 0x50, 0x9a, 0x9d, 0xb7, 0xd1, 0x5e, 0x80 }, // 2005000
-		{ 0xa2, 0xb6, 0x31, 0x18, 0x39, 0xe0, 0xd7, 0x94 }, // 0005000
-		{ 0xe9, 0xf2, 0x55, 0x3b, 0x23, 0xcc, 0x84, 0x95 }, // 7440442
-		{ 0xe2, 0x3b, 0x58, 0x82, 0x1e, 0xb6, 0x9a, 0x97 }, // 5555999
-		{ 0x52, 0xc7, 0x95, 0xfb, 0xed, 0x69, 0x64, 0x9b }, // 2555991
-		// 20
-
-		{ 0x3c, 0x27, 0xa6, 0xb4, 0x57, 0xc5, 0xcc, 0xa9 }, // mypwd938		
-		{ 0xad, 0x31, 0x87, 0xcc, 0xe3, 0xf4, 0x51, 0xac }, // mypwd123
-		{ 0x17, 0x28, 0xf5, 0x9b, 0xe8, 0x6f, 0x23, 0xb4 }, // my***333
-		{ 0x39, 0xf4, 0xf5, 0xe3, 0x44, 0x65, 0xc0, 0xd6 }, // my777
-		{ 0x1a, 0xa2, 0x64, 0xd4, 0xcc, 0xd8, 0xc7, 0xdf }, // mypwd512
-
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		// 40
-		
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0 },
-		
-		{ 0xcb, 0x68, 0x00, 0x08, 0x8f, 0x7a, 0x7d, 0xe4 }, // mypwd999
-		{ 0xac, 0xf3, 0xc7, 0x58, 0x6d, 0x81, 0xf3, 0xe4 }, // myzzz999
-		{ 0x2b, 0x94, 0x5f, 0x22, 0x82, 0x54, 0x73, 0xe5 }, // myzzz015
-		{ 0xb4, 0x16, 0x07, 0x6a, 0x16, 0xc3, 0x70, 0xfa }, // myzzz019
-		{ 0x11, 0x2e, 0x50, 0x58, 0x87, 0xc7, 0x28, 0xfe }, // mypwd000
-	}
-};
+// Tests use masks that compile into 1 configuration
+int word_gen_from_mask(char *str, struct word_gen *word_gen)
+{
+	struct mask *mask = mask_new(str, NULL);
+	if (!mask)
+		return -1;
+	int result = mask_next(mask, word_gen) && !mask_next(mask, word_gen)
+			? 0 : -1;
+	mask_delete(mask);
+	return result;
+}
 
 // 26**4 = 456,976
 // 456 976 000 candidates
-struct word_gen word_gen_m_llllddd = {
-	8,
-	{
-		{ 1, 0, 'm' },
-		{ 26, 0, 'a','b','c','d','e','f','g','h','i','j','k','l','m',
-				'n','o','p','q','r','s','t','u','v','w','x','y','z' },
-		{ 26, 0, 'a','b','c','d','e','f','g','h','i','j','k','l','m',
-				'n','o','p','q','r','s','t','u','v','w','x','y','z' },
-		{ 26, 0, 'a','b','c','d','e','f','g','h','i','j','k','l','m',
-				'n','o','p','q','r','s','t','u','v','w','x','y','z' },
-		{ 26, 0, 'a','b','c','d','e','f','g','h','i','j','k','l','m',
-				'n','o','p','q','r','s','t','u','v','w','x','y','z' },
-		{ 10, 0, 48, 49, 50, 51, 52,  53, 54, 55, 56, 57 },
-		{ 10, 0, 48, 49, 50, 51, 52,  53, 54, 55, 56, 57 },
-		{ 10, 0, 48, 49, 50, 51, 52,  53, 54, 55, 56, 57 }
-	},
-	0
-	//, {}, 1000
-};
+char *mask_m_llllddd = "m?l?l?l?l?d?d?d";
 
-// ?w?d?d?d
-struct word_gen word_gen_wddd = {
-	3,
-	{
-		{ 10, 0, 48, 49, 50, 51, 52,  53, 54, 55, 56, 57 },
-		{ 10, 0, 48, 49, 50, 51, 52,  53, 54, 55, 56, 57 },
-		{ 10, 0, 48, 49, 50, 51, 52,  53, 54, 55, 56, 57 }
-	},
-	1, 0 // insert word at position 0
-};
+char *mask_wddd = "?w?d?d?d";
 
-char *words[] = {
-	"my", "myaaa", "myab", "myabc",
-	"mypwd", "my**", "my***", "myzzz",
-	NULL };
+// Used if word list file isn't given
+char words[] =
+	"my\n" "myaaa\n" "myab\n" "myabc\n"
+	"mypwd\n" "my**\n" "my***\n" "myzzz\n";
 
 
 // This configuration generates 1 word "01234567"
@@ -404,31 +300,67 @@ int main(int argc, char **argv)
 	signal(SIGALRM, signal_handler);
 
 
-// Range bbb00000 - bbb99999
-// - Start from bbb00500, generate 1000 (until bbb01499)
-struct word_gen word_gen_100k = {
-	8,
-	{ 
-		{ 1, 0, 98 },
-		{ 1, 0, 98 },
-		{ 1, 0, 98 },
-		{ 10, 0, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57 },
-		{ 10, 0, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57 },
-		{ 10, 5, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57 }, 
-		{ 10, 0, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57 },
-		{ 10, 0, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57 }
-	},
-	0, {},
-	1000
-};
+	int do_exit = 0;
+	int i;
+	int pkt_id = 0;
+	// Packets for FPGAs are allocated here, deleted by board workers
+	struct pkt_pool *pool = pkt_pool_new();
+	if (!pool)
+		exit(EXIT_FAILURE);
+	// Word list test runs on FPGA #0 of one device.
+	// Words are streamed from the file (argv[1]) or built-in
+	struct word_list_stream *word_list = argc > 1
+			? word_list_stream_open(argv[1], 0)
+			: word_list_stream_new(words, strlen(words), 0);
+	struct mask *mask_w = mask_new(mask_wddd, NULL);
+	if (!word_list || !mask_w)
+		exit(EXIT_FAILURE);
+	struct hybrid *hybrid = hybrid_new(mask_w, word_list, pool);
+	if (!hybrid)
+		exit(EXIT_FAILURE);
+	struct device *wddd_device = NULL;
+	// Word list packets in flight, unit's start is the offset
+	// in the word list
+	struct work_queue wddd_queue = { 0 };
+	struct outpkt_results *results = outpkt_results_new(1024);
+	if (!results)
+		exit(EXIT_FAILURE);
+
+	// Results are reconstructed into candidates and verified on CPU
+	int wddd_salt;
+	uint64_t wddd_hash;
+	if (des_bs_decode(hashes[0], &wddd_salt, &wddd_hash) < 0)
+		exit(EXIT_FAILURE);
+	struct candidate_map *candidate_map = candidate_map_new();
+	struct des_bs *des_bs = des_bs_new(wddd_salt);
+	if (!candidate_map || !des_bs)
+		exit(EXIT_FAILURE);
 
+	struct word_gen word_gen_m_llllddd;
+	if (word_gen_from_mask(mask_m_llllddd, &word_gen_m_llllddd) < 0)
+		exit(EXIT_FAILURE);
 
+	// Keyspace of mask_m_llllddd runs against hashes of every salt.
+	// Hashes are loaded from the file (argv[2]) or built-in
+	struct job *job = job_new(&word_gen_m_llllddd, pool);
+	if (!job)
+		exit(EXIT_FAILURE);
+	if (argc > 2) {
+		if (job_load(job, argv[2]) < 0)
+			exit(EXIT_FAILURE);
+	}
+	else
+		for (i = 0; hashes[i]; i++)
+			job_add_hash(job, hashes[i]);
+	if (job_start(job) < 0)
+		exit(EXIT_FAILURE);
+	fprintf(stderr, "%llu hashes (%llu duplicates, %llu bad lines), %d groups\n",
+		(unsigned long long)job->num_hashes,
+		(unsigned long long)job->num_duplicates,
+		(unsigned long long)job->num_bad_lines, job->num_groups);
 
-	int do_exit = 0;
-	int pkt_id = 0;
-	int pkt_count = 0;
-	int sent = 0;
-	int inpkt_210_count = 0;
+	// Word list test is skipped if there are no hashes with its salt
+	struct cmp_config *wddd_cmp_config = job_find_salt(job, wddd_salt);
 
 	struct timeval tv0, tv1;
 	gettimeofday(&tv0, NULL);
@@ -445,84 +377,237 @@ struct word_gen word_gen_100k = {
 
 
 		int device_count = 0;
+		int device_idle = 1;
 		struct device *device;
+		// Each board gets its I/O thread
+		for (device = device_list->device; device; device = device->next) {
+			if (!device_valid(device) || device->worker)
+				continue;
+			device->worker = board_worker_new(device);
+			if (!device->worker) {
+				device_invalidate(device);
+				continue;
+			}
+			// Comparator is configured when FPGA gets its 1st chunk
+			for (i = 0; i < device->num_of_fpgas; i++) {
+				device->fpga[i].job = job_fpga_new(job);
+				if (!device->fpga[i].job)
+					exit(EXIT_FAILURE);
+			}
+		}
+
 		for (device = device_list->device; device; device = device->next) {
-usleep(20);
 			if (!device_valid(device))
 				continue;
 
 			if (signal_received)
 				break;
 
-			result = device_fpgas_pkt_rw(device);
+			struct board_worker *worker = device->worker;
+			result = board_worker_error(worker);
 			if (result < 0) {
 				fprintf(stderr, "SN %s error %d doing r/w of FPGAs (%s)\n",
 					device->ztex_device->snString, result, libusb_strerror(result) );
+				board_worker_stop(worker);
+				wr_byte_count += worker->wr_byte_count;
+				rd_byte_count += worker->rd_byte_count;
+				board_worker_print_stats(worker);
+				board_worker_delete(worker);
+				device->worker = NULL;
+
+				// Chunks in flight go to other FPGAs
+				for (i = 0; i < device->num_of_fpgas; i++) {
+					struct job_fpga *jf = device->fpga[i].job;
+					int j;
+					for (j = 0; j < jf->queue.num_units; j++)
+						candidate_map_remove(candidate_map, jf->queue.unit[j].pkt_id);
+					if (job_fpga_abort(job, jf) < 0)
+						exit(EXIT_FAILURE);
+					job_fpga_delete(job, jf);
+					device->fpga[i].job = NULL;
+				}
+				// Words in flight are streamed again
+				if (device == wddd_device) {
+					for (i = 0; i < wddd_queue.num_units; i++)
+						candidate_map_remove(candidate_map, wddd_queue.unit[i].pkt_id);
+					if (wddd_queue.num_units)
+						hybrid_seek(hybrid, wddd_queue.unit[0].start);
+					work_queue_clear(&wddd_queue);
+					wddd_device = NULL;
+				}
 				device_invalidate(device);
 				continue;
 			}
 			device_count ++;
 
+			int fpga_num;
+			for (fpga_num = 0; fpga_num < device->num_of_fpgas; fpga_num++) {
+				struct job_fpga *jf = device->fpga[fpga_num].job;
+				// FPGA runs word list test exclusively
+				int wddd_fpga = device == wddd_device && fpga_num == 0;
+				// Received packets are decoded in batches
+				for ( ; ; ) {
+					outpkt_results_clear(results);
+					if (!board_worker_recv_results(worker, fpga_num, results))
+						break;
+					device_idle = 0;
+
+					for (i = 0; i < results->cmp_equal_count; i++) {
+						struct outpkt_cmp_equal *cmp_equal = &results->cmp_equal[i];
+						unsigned char key[WORD_MAX_LEN + 1] = { 0 };
+						if (candidate_get(candidate_map, cmp_equal->pkt_id,
+								cmp_equal->word_id, cmp_equal->gen_id, key) < 0) {
+							fprintf(stderr, "CMP_EQUAL: pkt_id 0x%04x word_id %d gen_id %u:"
+								" unknown candidate\n", cmp_equal->pkt_id,
+								cmp_equal->word_id, cmp_equal->gen_id);
+							continue;
+						}
+						// Salt is of the configuration packet was sent with
+						struct cmp_config *cmp_config = job_cmp_config(job, cmp_equal->pkt_id);
+						if (wddd_fpga
+								&& work_queue_find(&wddd_queue, cmp_equal->pkt_id) != -1)
+							cmp_config = wddd_cmp_config;
+						if (des_bs->salt != cmp_config->salt)
+							des_bs_set_salt(des_bs, cmp_config->salt);
+						// Hash is looked up in the job (hash_num refers to
+						// the configuration without cracked hashes)
+						result = job_crack(job, jf, cmp_config->salt,
+								des_bs_crypt_one(des_bs, key));
+						// Duplicate result is suppressed
+						if (!result)
+							continue;
+						printf("CMP_EQUAL: pkt_id 0x%04x word_id %d gen_id %u hash_num %d"
+							" key \"%s\"%s\n", cmp_equal->pkt_id, cmp_equal->word_id,
+							cmp_equal->gen_id, cmp_equal->hash_num_eq, key,
+							result > 0 ? "" : " - VERIFICATION FAILED");
+					}
+					for (i = 0; i < results->done_count; i++) {
+						struct outpkt_done *done = &results->done[i];
+						printf("PROCESSING_DONE: SN %s FPGA #%d pkt_id 0x%04x"
+							" num_processed %u\n", device->ztex_device->snString,
+							fpga_num, done->pkt_id, done->num_processed);
+						candidate_map_remove(candidate_map, done->pkt_id);
+						if (wddd_fpga && !work_queue_done(&wddd_queue,
+								done->pkt_id, done->num_processed, NULL))
+							continue;
+						result = job_fpga_done(job, jf,
+								done->pkt_id, done->num_processed);
+						if (result == -1)
+							fprintf(stderr, "PROCESSING_DONE: pkt_id 0x%04x:"
+								" unknown chunk\n", done->pkt_id);
+						else if (result < 0)
+							exit(EXIT_FAILURE);
+					}
+					if (results->other_count || results->error_count)
+						fprintf(stderr, "%d packets of unknown type, %d bad packets\n",
+							results->other_count, results->error_count);
+				}
 
-			struct pkt *inpkt;
-			int inpkt_type;
-			// Using FPGA #0 of each device for tests
-			while ( (inpkt = pkt_queue_fetch(device->fpga[0].comm->input_queue) ) ) {
-				
-				printf("inpkt type %d len %d: ",inpkt->type,inpkt->data_len);
-				int i;
-				for (i=0; i < inpkt->data_len; i++)
-					printf("%02x ", inpkt->data[i]);
-				printf("\n");
-							
-				//if (!(++pkt_count % 256000)) {
-				//	printf(".");
-				//	fflush(stdout);
-				//}
-				inpkt_type = inpkt->type;
-				pkt_delete(inpkt);
-				
-				if (inpkt_type == 210 && ++inpkt_210_count >= 2) {
-					do_exit = 1;
-					break;
+				// Packets that don't fit into the worker's ring are sent
+				// on the next round, work that isn't sent is taken back
+				struct pkt *outpkt;
+				if (wddd_cmp_config && !wddd_device && !hybrid_end(hybrid)
+						&& fpga_num == 0) {
+					outpkt = pkt_cmp_config_new_pool(pool, wddd_cmp_config);
+					if (outpkt && board_worker_send(worker, fpga_num, outpkt) < 0) {
+						pkt_delete(outpkt);
+						outpkt = NULL;
+					}
+					if (outpkt) {
+						wddd_device = device;
+						wddd_fpga = 1;
+						job_fpga_unconfigure(job, jf);
+					}
 				}
-			}
-			//printf("\n");
-			//printf("pkt_count: %d\n", get_pkt_count());
-			if (do_exit)
-				break;
-		
-			struct pkt *outpkt;
-			struct pkt *outpkt2;
-			int i;
-			if (sent)
-				break;
-				
-			if (!sent) {
-				outpkt = pkt_cmp_config_new(&cmp_55_my);
-				pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
-				//sent = 1;
-			}
 
-			for (i=0; i < 1; i++) {
-				outpkt = pkt_word_gen_new(&word_gen_wddd);
-				outpkt->id = 0xabcd;//pkt_id++;
-				pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
-				
-				outpkt = pkt_word_list_new(words);
-				pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
-			
-				
-				outpkt = pkt_word_gen_new(&word_gen_m_llllddd);
-				outpkt->id = 0xabcd;//pkt_id++;
-				pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
-				
-				sent = 1;
-			}
-			
+				// Each word list follows WORD_GEN packet
+				// (words take the unit time at the measured rate)
+				while (wddd_fpga && !work_queue_full(&wddd_queue)
+						&& board_worker_space(worker, fpga_num) >= 2) {
+					struct word_gen word_gen;
+					struct pkt *word_list_pkt;
+					size_t offset;
+					uint64_t candidate_count = hybrid->candidate_count;
+					if (!hybrid_next(hybrid, work_queue_count(&wddd_queue, 0, 0),
+							&word_gen, &word_list_pkt, &offset))
+						break;
+					outpkt = pkt_word_gen_new_pool(pool, &word_gen);
+					if (outpkt) {
+						outpkt->id = pkt_id;
+						if (candidate_map_add_pkt(candidate_map, outpkt->id,
+								&word_gen, word_list_pkt) < 0) {
+							pkt_delete(outpkt);
+							outpkt = NULL;
+						}
+					}
+					if (!outpkt) {
+						// Words are streamed again
+						pkt_delete(word_list_pkt);
+						hybrid_seek(hybrid, offset);
+						pkt_id++;
+						break;
+					}
+					// Both packets fit, the worker only adds space
+					if (board_worker_send(worker, fpga_num, outpkt) < 0
+							|| board_worker_send(worker, fpga_num, word_list_pkt) < 0) {
+						fprintf(stderr, "SN %s #%d: unable to send word list\n",
+							device->ztex_device->snString, fpga_num);
+						exit(EXIT_FAILURE);
+					}
+					work_queue_add(&wddd_queue, pkt_id++, offset,
+							hybrid->candidate_count - candidate_count);
+				}
+				if (wddd_fpga && !hybrid_end(hybrid))
+					continue;
+
+				// Keep the next chunk in FPGA's input.
+				// CMP_CONFIG is sent if FPGA takes another group
+				while (board_worker_space(worker, fpga_num) >= 2) {
+					struct word_gen word_gen;
+					struct pkt *cmp_config_pkt;
+					int result = job_fpga_next(job, jf, pkt_id, &word_gen,
+							&cmp_config_pkt);
+					if (cmp_config_pkt
+							&& board_worker_send(worker, fpga_num, cmp_config_pkt) < 0) {
+						// FPGA is configured again with the next chunk
+						pkt_delete(cmp_config_pkt);
+						if (result && job_fpga_cancel(job, jf, pkt_id) < 0)
+							exit(EXIT_FAILURE);
+						job_fpga_unconfigure(job, jf);
+						break;
+					}
+					if (!result)
+						break;
+					outpkt = pkt_word_gen_new_pool(pool, &word_gen);
+					if (outpkt) {
+						outpkt->id = pkt_id;
+						if (candidate_map_add(candidate_map, outpkt->id,
+								&word_gen, NULL) < 0) {
+							pkt_delete(outpkt);
+							outpkt = NULL;
+						}
+						else if (board_worker_send(worker, fpga_num, outpkt) < 0) {
+							candidate_map_remove(candidate_map, outpkt->id);
+							pkt_delete(outpkt);
+							outpkt = NULL;
+						}
+					}
+					if (!outpkt) {
+						if (job_fpga_cancel(job, jf, pkt_id) < 0)
+							exit(EXIT_FAILURE);
+						pkt_id++;
+						break;
+					}
+					pkt_id++;
+				}
+			} // for (fpga_num)
 
 		} // for (device_list)
 
+		if ((!wddd_cmp_config || hybrid_end(hybrid)) && !wddd_queue.num_units
+				&& job_finished(job))
+			do_exit = 1;
+
 		if (do_exit)
 			break;
 			
@@ -530,6 +615,10 @@ usleep(20);
 			fprintf(stderr, "Signal received.\n");
 			break;
 		}
+
+		// Workers do I/O, nothing to do here until results arrive
+		if (device_idle)
+			usleep(100);
 	} // for(;;)
 
 
@@ -549,10 +638,53 @@ usleep(20);
 
 	} // for(;;)
 */
+	struct device *device;
+	for (device = device_list->device; device; device = device->next) {
+		if (!device->worker)
+			continue;
+		board_worker_stop(device->worker);
+		wr_byte_count += device->worker->wr_byte_count;
+		rd_byte_count += device->worker->rd_byte_count;
+		board_worker_print_stats(device->worker);
+		board_worker_delete(device->worker);
+		device->worker = NULL;
+
+		int i;
+		for (i = 0; i < device->num_of_fpgas; i++) {
+			struct job_fpga *jf = device->fpga[i].job;
+			fprintf(stderr, "SN %s FPGA #%d: rate %.2f Mcand/s, %d reconfigurations"
+				", drain %.0f usec, queue %d (starved %d)\n",
+				device->ztex_device->snString, i,
+				jf->queue.rate / 1e6, jf->num_reconfigs,
+				jf->num_drains ? jf->drain_usec / jf->num_drains : 0,
+				jf->queue.max_units ? jf->queue.max_units : WORK_QUEUE_UNITS,
+				jf->queue.num_starved);
+			job_fpga_delete(job, jf);
+			device->fpga[i].job = NULL;
+		}
+	}
+	fprintf(stderr, "Word list: %llu words, %llu skipped\n",
+		word_list->word_count, word_list->skip_count);
+	if (hybrid->candidate_count)
+		fprintf(stderr, "Hybrid: %llu candidates, %.4f bytes/candidate\n",
+			hybrid->candidate_count,
+			(double)hybrid->byte_count / hybrid->candidate_count);
+	fprintf(stderr, "Job: %d of %d groups done (%d merged), %d reconfigurations\n",
+		job->num_groups_done, job->num_groups, job->num_merged, job->num_reconfigs);
+	fprintf(stderr, "Cracked %llu of %llu hashes, %llu duplicate results,"
+		" %d shrunken configurations\n",
+		(unsigned long long)job->num_cracked, (unsigned long long)job->num_hashes,
+		(unsigned long long)job->num_dup_results, job->num_shrinks);
+	fprintf(stderr, "Reconfiguration: drain %.0f usec, chunks %.2f s\n",
+		job->drain_usec, job_chunk_usec(job) / 1e6);
+	struct pkt_pool_stats pool_stats;
+	pkt_pool_get_stats(pool, &pool_stats);
+	fprintf(stderr, "Packet pool: %lu allocations, %lu from the heap (%d slabs)\n",
+		pool_stats.alloc_count, pool_stats.heap_count, pool_stats.slab_count);
+
 	gettimeofday(&tv1, NULL);
 	unsigned long usec = (tv1.tv_sec - tv0.tv_sec)*1000000 + tv1.tv_usec - tv0.tv_usec;
 	float kbyte_count = (wr_byte_count+rd_byte_count)/1024;
-	unsigned long long cmd_count = 0;
 
 	fprintf(stderr,
 		"%.2f MB write, %.2f MB read, rate %.2f MB/s\n",
@@ -560,6 +692,14 @@ usleep(20);
 		(float)rd_byte_count/1024/1024, kbyte_count *1000000/usec /1024
 	);
 	
+	outpkt_results_delete(results);
+	candidate_map_delete(candidate_map);
+	des_bs_delete(des_bs);
+	job_delete(job);
+	hybrid_delete(hybrid);
+	mask_delete(mask_w);
+	word_list_stream_delete(word_list);
+	pkt_pool_delete(pool);
 
 	libusb_exit(NULL);
 }
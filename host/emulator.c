@@ -0,0 +1,1273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <crypt.h>
+#include <libusb-1.0/libusb.h>
+
+#include "ztex.h"
+#include "inouttraffic.h"
+#include "pkt_comm/pkt_comm.h"
+#include "pkt_comm/word_list.h"
+#include "pkt_comm/word_gen.h"
+#include "pkt_comm/cmp_config.h"
+#include "pkt_comm/outpkt.h"
+#include "emulator.h"
+
+//===============================================================
+//
+// ZTEX 1.15y board emulator. See emulator.h
+//
+//===============================================================
+
+struct emu_params emu_params = {
+	1,	// num_boards
+	4,	// num_fpgas
+	1,	// firmware
+	1,	// bitstream
+	0,	// rate
+	1,	// compute
+	0,	// fail_after
+	0	// drain_usec
+};
+
+// libusb_device objects are never freed until libusb_exit(),
+// so pointers held by the host stay valid after disconnect.
+struct libusb_device {
+	struct emu_board *board;
+	int devnum;
+	int gone;			// disconnected (under board->lock)
+	struct libusb_device *next;
+};
+
+struct libusb_device_handle {
+	struct libusb_device *dev;
+};
+
+// Protects the board list and the list of libusb_device's.
+// Lock order: emu_lock, then board->lock
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct emu_board *emu_board[EMU_BOARDS_MAX];
+static int emu_num_boards;
+static struct libusb_device *emu_usb_devs;
+static int emu_init_count;
+
+static const char emu_ascii64[] =
+	"./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static uint64_t emu_time_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// =======================================================================
+//
+// FPGA
+//
+// =======================================================================
+
+// Global Set Reset: FPGA comes to its post-configuration state
+static void emu_fpga_reset(struct emu_fpga *fpga)
+{
+	fpga->hs_io_enable = 0;
+	fpga->output_limit_enable = 1;
+	fpga->app_mode = 0;
+	fpga->app_status = 0;
+	fpga->pkt_comm_status = 0;
+	fpga->input_head = fpga->input_tail = 0;
+	fpga->inpkt_header_len = 0;
+	fpga->inpkt_data_len = 0;
+	fpga->inpkt_ready = 0;
+	fpga->output_head = fpga->output_tail = fpga->output_limit = 0;
+	fpga->word_list_len = 0;
+	fpga->word_list_id = 0;
+	fpga->gen_state = EMU_GEN_IDLE;
+	fpga->num_processed = 0;
+	fpga->cmp_configured = 0;
+	fpga->run_usec = emu_time_usec();
+	fpga->credit = 0;
+}
+
+static int emu_fpga_init(struct emu_fpga *fpga, int num)
+{
+	fpga->num = num;
+	fpga->input = malloc(EMU_INPUT_FIFO_SIZE);
+	fpga->inpkt_data = malloc(PKT_MAX_LEN + PKT_CHECKSUM_LEN);
+	fpga->output = malloc(EMU_OUTPUT_FIFO_SIZE);
+	fpga->word_list = malloc(PKT_MAX_LEN);
+	fpga->crypt_data = calloc(1, sizeof(struct crypt_data));
+	if (!fpga->input || !fpga->inpkt_data || !fpga->output
+			|| !fpga->word_list || !fpga->crypt_data) {
+		fprintf(stderr, "emu_fpga_init: unable to allocate memory\n");
+		return -1;
+	}
+	fpga->configured = emu_params.bitstream;
+	fpga->candidate_count = 0;
+	fpga->cmp_equal_count = 0;
+	emu_fpga_reset(fpga);
+	return 0;
+}
+
+static void emu_fpga_free(struct emu_fpga *fpga)
+{
+	free(fpga->input);
+	free(fpga->inpkt_data);
+	free(fpga->output);
+	free(fpga->word_list);
+	free(fpga->crypt_data);
+}
+
+static int emu_input_count(struct emu_fpga *fpga)
+{
+	return fpga->input_head - fpga->input_tail;
+}
+
+static int emu_output_free(struct emu_fpga *fpga)
+{
+	return EMU_OUTPUT_FIFO_MAX - (fpga->output_head - fpga->output_tail);
+}
+
+static void emu_output_write(struct emu_fpga *fpga, unsigned char *data, int len)
+{
+	int i;
+	for (i = 0; i < len; i++)
+		fpga->output[fpga->output_head++ % EMU_OUTPUT_FIFO_SIZE] = data[i];
+	if (!fpga->output_limit_enable)
+		fpga->output_limit = fpga->output_head;
+}
+
+// Creates output packet (outpkt_v2.v). Returns -1 if output FIFO is full
+static int emu_fpga_outpkt(struct emu_fpga *fpga, int type,
+		unsigned char *data, int len)
+{
+	unsigned char buf[PKT_HEADER_LEN + 2 * PKT_CHECKSUM_LEN + OUTPKT_CMP_EQUAL_LEN];
+	int pkt_len = PKT_HEADER_LEN + 2 * PKT_CHECKSUM_LEN + len;
+	if (emu_output_free(fpga) < pkt_len)
+		return -1;
+
+	memset(buf, 0, PKT_HEADER_LEN);
+	buf[0] = PKT_COMM_VERSION;
+	buf[1] = type;
+	buf[4] = len;
+	buf[5] = len >> 8;
+	buf[6] = len >> 16;
+	// outpkt_v2.v doesn't count output packets, id is 0
+	pkt_checksum(buf + PKT_HEADER_LEN, buf, PKT_HEADER_LEN);
+	memcpy(buf + PKT_HEADER_LEN + PKT_CHECKSUM_LEN, data, len);
+	pkt_checksum(buf + PKT_HEADER_LEN + PKT_CHECKSUM_LEN + len,
+			data, len);
+	emu_output_write(fpga, buf, pkt_len);
+	return 0;
+}
+
+
+// *****************************************************************
+//
+// Input packets (inpkt_header.v)
+//
+// *****************************************************************
+
+// Reads bytes from input FIFO until there's a complete packet
+static void emu_fpga_inpkt_read(struct emu_fpga *fpga)
+{
+	while (!fpga->inpkt_ready && !fpga->pkt_comm_status
+			&& emu_input_count(fpga)) {
+
+		if (fpga->inpkt_header_len < PKT_HEADER_LEN + PKT_CHECKSUM_LEN) {
+			unsigned char c = fpga->input[fpga->input_tail++ % EMU_INPUT_FIFO_SIZE];
+			// packets can be padded with 0
+			if (!fpga->inpkt_header_len && !c)
+				continue;
+			fpga->inpkt_header[fpga->inpkt_header_len++] = c;
+			if (fpga->inpkt_header_len < PKT_HEADER_LEN + PKT_CHECKSUM_LEN)
+				continue;
+
+			unsigned char *header = fpga->inpkt_header;
+			fpga->inpkt_len = header[4] | header[5] << 8 | header[6] << 16;
+			if (header[0] != PKT_COMM_VERSION)
+				fpga->pkt_comm_status |= EMU_ERR_PKT_VERSION;
+			else if (header[1] != PKT_TYPE_WORD_LIST && header[1] != PKT_TYPE_WORD_GEN
+					&& header[1] != PKT_TYPE_CMP_CONFIG)
+				fpga->pkt_comm_status |= EMU_ERR_INPKT_TYPE;
+			else if (!fpga->inpkt_len || fpga->inpkt_len > PKT_MAX_LEN)
+				fpga->pkt_comm_status |= EMU_ERR_INPKT_LEN;
+			else if (pkt_checksum(NULL, header, PKT_HEADER_LEN)
+					!= pkt_checksum_read(header + PKT_HEADER_LEN))
+				fpga->pkt_comm_status |= EMU_ERR_INPKT_CHECKSUM;
+			fpga->inpkt_data_len = 0;
+			continue;
+		}
+
+		int len = fpga->inpkt_len + PKT_CHECKSUM_LEN - fpga->inpkt_data_len;
+		if (len > emu_input_count(fpga))
+			len = emu_input_count(fpga);
+		int i;
+		for (i = 0; i < len; i++)
+			fpga->inpkt_data[fpga->inpkt_data_len++]
+				= fpga->input[fpga->input_tail++ % EMU_INPUT_FIFO_SIZE];
+		if (fpga->inpkt_data_len < fpga->inpkt_len + PKT_CHECKSUM_LEN)
+			continue;
+
+		if (pkt_checksum(NULL, fpga->inpkt_data, fpga->inpkt_len)
+				!= pkt_checksum_read(fpga->inpkt_data + fpga->inpkt_len))
+			fpga->pkt_comm_status |= EMU_ERR_INPKT_CHECKSUM;
+		else
+			fpga->inpkt_ready = 1;
+		fpga->inpkt_header_len = 0;
+	}
+}
+
+// word_gen.v configuration. Returns -1 on error
+static int emu_word_gen_conf(struct word_gen *word_gen, unsigned char *data, int len)
+{
+	int offset = 0;
+	int i, j;
+
+	if (offset + 1 > len)
+		return -1;
+	word_gen->num_ranges = data[offset++];
+	if (word_gen->num_ranges > RANGES_MAX)
+		return -1;
+	for (i = 0; i < word_gen->num_ranges; i++) {
+		struct word_gen_char_range *range = &word_gen->ranges[i];
+		if (offset + 2 > len)
+			return -1;
+		range->num_chars = data[offset++];
+		range->start_idx = data[offset++];
+		if (!range->num_chars || range->num_chars > sizeof(range->chars)
+				|| range->start_idx >= range->num_chars
+				|| offset + range->num_chars > len)
+			return -1;
+		for (j = 0; j < range->num_chars; j++)
+			range->chars[j] = data[offset++] & ((1 << CHAR_BITS) - 1);
+	}
+
+	if (offset + 1 > len)
+		return -1;
+	word_gen->num_words = data[offset++];
+	if (word_gen->num_words > WORDS_INSERT_MAX
+			|| (!word_gen->num_words && !word_gen->num_ranges)
+			|| offset + word_gen->num_words > len)
+		return -1;
+	for (i = 0; i < word_gen->num_words; i++)
+		word_gen->word_insert_pos[i] = data[offset++];
+
+	if (offset + 5 != len)
+		return -1;
+	word_gen->num_generate = data[offset] | data[offset + 1] << 8
+		| data[offset + 2] << 16 | (unsigned long)data[offset + 3] << 24;
+	word_gen->magic = data[offset + 4];
+	if (word_gen->magic != 0xBB)
+		return -1;
+	return 0;
+}
+
+// cmp_config.v. Returns -1 on error
+static int emu_cmp_config(struct emu_fpga *fpga, unsigned char *data, int len)
+{
+	if (len < 5)
+		return -1;
+	int salt = data[0] | data[1] << 8;
+	int num_hashes = data[2] | data[3] << 8;
+	if (salt >> 12 || !num_hashes || num_hashes > CMP_CONFIG_NUM_HASHES_MAX
+			|| len != 5 + num_hashes * CMP_CONFIG_HASH_LEN
+			|| data[len - 1] != 0xCC)
+		return -1;
+
+	fpga->salt[0] = emu_ascii64[salt & 0x3f];
+	fpga->salt[1] = emu_ascii64[salt >> 6];
+	fpga->salt[2] = 0;
+	fpga->num_hashes = num_hashes;
+	int i, j;
+	for (i = 0; i < num_hashes; i++) {
+		uint64_t hash = 0;
+		for (j = CMP_CONFIG_HASH_LEN - 1; j >= 0; j--)
+			hash = hash << 8 | data[4 + i * CMP_CONFIG_HASH_LEN + j];
+		fpga->hash[i] = hash;
+	}
+	fpga->cmp_configured = 1;
+	return 0;
+}
+
+// Takes received packet. Returns 0 if the packet has to wait
+static int emu_fpga_inpkt_process(struct emu_fpga *fpga)
+{
+	int type = fpga->inpkt_header[1];
+	int len = fpga->inpkt_len;
+
+	if (type == PKT_TYPE_WORD_LIST) {
+		// previous list isn't used up yet
+		if (fpga->word_list_len)
+			return 0;
+		memcpy(fpga->word_list, fpga->inpkt_data, len);
+		fpga->word_list_len = len;
+		fpga->word_list_offset = 0;
+	}
+
+	else if (type == PKT_TYPE_WORD_GEN) {
+		if (fpga->gen_state != EMU_GEN_IDLE)
+			return 0;
+		if (emu_word_gen_conf(&fpga->word_gen, fpga->inpkt_data, len) < 0) {
+			fpga->pkt_comm_status |= EMU_ERR_WORD_GEN_CONF;
+			return 0;
+		}
+		fpga->gen_pkt_id = fpga->inpkt_header[8] | fpga->inpkt_header[9] << 8;
+		fpga->gen_state = EMU_GEN_WORD;
+		fpga->word_len = 0;
+		fpga->word_id = 0;
+		fpga->num_processed = 0;
+	}
+
+	else if (type == PKT_TYPE_CMP_CONFIG) {
+		// New configuration is applied after cores are idle
+		if (fpga->gen_state != EMU_GEN_IDLE)
+			return 0;
+		if (emu_cmp_config(fpga, fpga->inpkt_data, len) < 0) {
+			fpga->pkt_comm_status |= EMU_ERR_CMP_CONFIG;
+			return 0;
+		}
+		fpga->drain = (double)emu_params.drain_usec * emu_params.rate / 1000000;
+	}
+
+	fpga->inpkt_ready = 0;
+	return 1;
+}
+
+
+// *****************************************************************
+//
+// Word list, word generator (word_list.v, word_gen.v)
+//
+// *****************************************************************
+
+// Gets next word from word_list. Returns 0 if there's no word list
+static int emu_fpga_next_word(struct emu_fpga *fpga)
+{
+	if (!fpga->word_list_len)
+		return 0;
+
+	int char_count = 0;
+	int end = 0;
+	memset(fpga->word, 0, WORD_MAX_LEN);
+	while (!end) {
+		unsigned char c = fpga->word_list[fpga->word_list_offset++];
+		end = fpga->word_list_offset == fpga->word_list_len;
+		if (!c && !char_count) {
+			// extra \0 or empty word - skip
+		}
+		else if (!c)
+			break;
+		else if (char_count == WORD_MAX_LEN)
+			// word exceeds max.length; extra chars skipped
+			fpga->pkt_comm_status |= EMU_ERR_WORD_LIST_LEN;
+		else
+			fpga->word[char_count++] = c & ((1 << CHAR_BITS) - 1);
+	}
+
+	fpga->word_len = char_count;
+	fpga->word_id = fpga->word_list_id;
+	fpga->word_list_end = end;
+	if (fpga->word_list_id == 0xFFFF)
+		fpga->pkt_comm_status |= EMU_ERR_WORD_LIST_COUNT;
+	fpga->word_list_id = end ? 0 : fpga->word_list_id + 1;
+	if (end)
+		fpga->word_list_len = 0;
+	return 1;
+}
+
+// Starts generation for the word
+static void emu_fpga_gen_start(struct emu_fpga *fpga)
+{
+	struct word_gen *word_gen = &fpga->word_gen;
+	uint64_t total = 1, start = 0;
+	int i;
+	for (i = 0; i < word_gen->num_ranges; i++) {
+		struct word_gen_char_range *range = &word_gen->ranges[i];
+		fpga->gen_idx[i] = range->start_idx;
+		start = start * range->num_chars + range->start_idx;
+		total *= range->num_chars;
+	}
+	// the last range changes fastest, ends after all ranges reach their last chars
+	fpga->gen_left = total - start;
+	if (word_gen->num_generate && word_gen->num_generate < fpga->gen_left)
+		fpga->gen_left = word_gen->num_generate;
+	fpga->gen_id = 0;
+	fpga->gen_state = EMU_GEN_RUN;
+}
+
+// Current candidate (word_insert.v)
+static void emu_fpga_candidate(struct emu_fpga *fpga, unsigned char *key)
+{
+	struct word_gen *word_gen = &fpga->word_gen;
+	int insert_pos = word_gen->num_words ? word_gen->word_insert_pos[0] : WORD_MAX_LEN;
+	int len = word_gen->num_words ? fpga->word_len : 0;
+	int i;
+	for (i = 0; i < WORD_MAX_LEN; i++) {
+		int range_num = i < insert_pos ? i : i - len;
+		if (i >= insert_pos && i < insert_pos + len)
+			key[i] = fpga->word[i - insert_pos];
+		else if (range_num < word_gen->num_ranges)
+			key[i] = word_gen->ranges[range_num].chars[ fpga->gen_idx[range_num] ];
+		else
+			key[i] = 0;
+	}
+}
+
+static void emu_fpga_gen_next(struct emu_fpga *fpga)
+{
+	struct word_gen *word_gen = &fpga->word_gen;
+	int i;
+	for (i = word_gen->num_ranges - 1; i >= 0; i--) {
+		if (++fpga->gen_idx[i] < word_gen->ranges[i].num_chars)
+			break;
+		fpga->gen_idx[i] = 0;
+	}
+}
+
+
+// *****************************************************************
+//
+// Arbiter, cores and comparator (arbiter.v)
+//
+// *****************************************************************
+
+// Computes descrypt hash as it's stored in the comparator:
+// 64 bits of DES output, 1st bit is LSB.
+// Returns -1 on error
+static int emu_descrypt(struct emu_fpga *fpga, unsigned char *key, uint64_t *hash)
+{
+	char key_str[WORD_MAX_LEN + 1];
+	int len, i, j;
+
+	// crypt(3) stops at \0 while FPGA takes all 8 chars.
+	// 0x80 gives same 0 key bits.
+	for (len = WORD_MAX_LEN; len > 0 && !key[len - 1]; len--)
+		;
+	for (i = 0; i < len; i++)
+		key_str[i] = key[i] ? key[i] : 0x80;
+	key_str[len] = 0;
+
+	char *result = crypt_r(key_str, fpga->salt, fpga->crypt_data);
+	if (!result || strlen(result) != 13)
+		return -1;
+
+	// 11 chars of 6 bits encode DES output MSB first
+	*hash = 0;
+	for (i = 0; i < 11; i++) {
+		char *c = strchr(emu_ascii64, result[2 + i]);
+		if (!c || !*c)
+			return -1;
+		int value = c - emu_ascii64;
+		for (j = 0; j < 6 && i * 6 + j < 64; j++)
+			if (value & (1 << (5 - j)))
+				*hash |= 1ULL << (i * 6 + j);
+	}
+	return 0;
+}
+
+// Binary search, hashes are expected in ascending order.
+// Returns hash number or -1
+static int emu_cmp_search(struct emu_fpga *fpga, uint64_t hash)
+{
+	int lo = 0, hi = fpga->num_hashes - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (fpga->hash[mid] == hash)
+			return mid;
+		if (fpga->hash[mid] < hash)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+static int emu_outpkt_cmp_equal(struct emu_fpga *fpga, int hash_num)
+{
+	unsigned char data[OUTPKT_CMP_EQUAL_LEN] = {
+		fpga->gen_pkt_id, fpga->gen_pkt_id >> 8,
+		fpga->word_id, fpga->word_id >> 8,
+		fpga->gen_id, fpga->gen_id >> 8, fpga->gen_id >> 16, fpga->gen_id >> 24,
+		hash_num, hash_num >> 8
+	};
+	return emu_fpga_outpkt(fpga, PKT_TYPE_CMP_EQUAL, data, OUTPKT_CMP_EQUAL_LEN);
+}
+
+static int emu_outpkt_done(struct emu_fpga *fpga)
+{
+	unsigned char data[OUTPKT_DONE_LEN] = {
+		fpga->gen_pkt_id, fpga->gen_pkt_id >> 8,
+		fpga->num_processed, fpga->num_processed >> 8,
+		fpga->num_processed >> 16, fpga->num_processed >> 24
+	};
+	return emu_fpga_outpkt(fpga, PKT_TYPE_PROCESSING_DONE, data, OUTPKT_DONE_LEN);
+}
+
+// Processes up to 'max' candidates. Returns number of processed candidates
+// or -1 if generation has stalled
+static int64_t emu_fpga_generate(struct emu_fpga *fpga, int64_t max)
+{
+	int64_t count = 0;
+
+	while (count < max) {
+		if (fpga->gen_state == EMU_GEN_WORD) {
+			if (!fpga->word_gen.num_words) {
+				fpga->word_list_end = 1;
+				emu_fpga_gen_start(fpga);
+			}
+			else if (emu_fpga_next_word(fpga))
+				emu_fpga_gen_start(fpga);
+			else
+				break;
+		}
+
+		if (fpga->gen_state == EMU_GEN_DONE) {
+			if (emu_outpkt_done(fpga) < 0)
+				break;
+			fpga->gen_state = EMU_GEN_IDLE;
+			fpga->num_processed = 0;
+		}
+
+		if (fpga->gen_state != EMU_GEN_RUN)
+			break;
+
+		if (!fpga->gen_left) {
+			fpga->gen_state = fpga->word_list_end ? EMU_GEN_DONE : EMU_GEN_WORD;
+			continue;
+		}
+
+		if (!fpga->cmp_configured)
+			fpga->app_status |= EMU_ERR_CMP_NO_CONF;
+
+		uint64_t n;
+		if (emu_params.compute) {
+			// a match must fit into output FIFO
+			if (emu_output_free(fpga) < PKT_HEADER_LEN
+					+ 2 * PKT_CHECKSUM_LEN + OUTPKT_CMP_EQUAL_LEN)
+				break;
+			unsigned char key[WORD_MAX_LEN];
+			uint64_t hash;
+			emu_fpga_candidate(fpga, key);
+			if (fpga->cmp_configured && !emu_descrypt(fpga, key, &hash)) {
+				int hash_num = emu_cmp_search(fpga, hash);
+				if (hash_num >= 0) {
+					emu_outpkt_cmp_equal(fpga, hash_num);
+					fpga->cmp_equal_count++;
+				}
+			}
+			emu_fpga_gen_next(fpga);
+			n = 1;
+		}
+		else {
+			uint64_t room = max - count;
+			n = fpga->gen_left < room ? fpga->gen_left : room;
+		}
+
+		fpga->gen_left -= n;
+		fpga->gen_id += n;
+		fpga->num_processed += n;
+		fpga->candidate_count += n;
+		count += n;
+	}
+	return count;
+}
+
+// Moves input to output in application modes 0 and 1 (8 to 16-bit)
+static int emu_fpga_loopback(struct emu_fpga *fpga)
+{
+	int len = emu_input_count(fpga);
+	if (len > emu_output_free(fpga))
+		len = emu_output_free(fpga);
+	len &= ~(OUTPUT_WORD_WIDTH - 1);
+	int i;
+	for (i = 0; i < len; i++)
+		fpga->output[fpga->output_head++ % EMU_OUTPUT_FIFO_SIZE]
+			= fpga->input[fpga->input_tail++ % EMU_INPUT_FIFO_SIZE];
+	if (!fpga->output_limit_enable)
+		fpga->output_limit = fpga->output_head;
+	return len;
+}
+
+// Advances FPGA for the time passed since the last access
+static void emu_fpga_run(struct emu_fpga *fpga)
+{
+	uint64_t now = emu_time_usec();
+	uint64_t usec = now - fpga->run_usec;
+	fpga->run_usec = now;
+	if (!fpga->configured)
+		return;
+
+	if (fpga->app_mode == 0 || fpga->app_mode == 1) {
+		emu_fpga_loopback(fpga);
+		return;
+	}
+	if (fpga->app_mode != 2 && fpga->app_mode != 3)
+		return;
+
+	int64_t budget;
+	if (emu_params.rate) {
+		if (usec > EMU_RUN_MAX_USEC)
+			usec = EMU_RUN_MAX_USEC;
+		fpga->credit += (double)usec * emu_params.rate / 1000000;
+		// Time passes while cores drain
+		if (fpga->drain > 0) {
+			double idle = fpga->drain < fpga->credit ? fpga->drain : fpga->credit;
+			fpga->drain -= idle;
+			fpga->credit -= idle;
+		}
+		budget = (int64_t)fpga->credit;
+	}
+	else if (emu_params.compute)
+		budget = EMU_RUN_BATCH;
+	else
+		budget = INT64_MAX;
+
+	for ( ; ; ) {
+		int progress = 0;
+		emu_fpga_inpkt_read(fpga);
+		if (fpga->inpkt_ready && !fpga->pkt_comm_status)
+			progress = emu_fpga_inpkt_process(fpga);
+
+		int64_t count = emu_fpga_generate(fpga, budget);
+		budget -= count;
+		if (emu_params.rate)
+			fpga->credit -= count;
+		if (count)
+			progress = 1;
+		if (!progress || fpga->pkt_comm_status)
+			break;
+	}
+
+	// Idle FPGA doesn't accumulate time
+	if (fpga->gen_state != EMU_GEN_RUN)
+		fpga->credit = 0;
+}
+
+static unsigned char emu_fpga_io_state(struct emu_fpga *fpga)
+{
+	unsigned char io_state = 0;
+	if (EMU_INPUT_FIFO_SIZE - emu_input_count(fpga) < EMU_INPUT_PROG_FULL_GAP)
+		io_state |= IO_STATE_INPUT_PROG_FULL;
+	if (fpga->output_limit != fpga->output_tail)
+		io_state |= IO_STATE_LIMIT_NOT_DONE;
+	return io_state;
+}
+
+// VR 0x84
+static int emu_fpga_get_io_state(struct emu_fpga *fpga, unsigned char *buf)
+{
+	if (!fpga->configured) {
+		memset(buf, 0xFF, 6);
+		return 6;
+	}
+	buf[0] = emu_fpga_io_state(fpga);
+	buf[1] = 0xFF;		// hs_io timeout: no I/O in progress
+	buf[2] = fpga->app_status;
+	buf[3] = fpga->pkt_comm_status;
+	buf[4] = 0xD2;		// debug2
+	buf[5] = 0xD3;		// debug3
+	return 6;
+}
+
+// VR 0x85: output limit in OUTPUT_WORD_WIDTH-byte words
+static int emu_fpga_reg_output_limit(struct emu_fpga *fpga, unsigned char *buf)
+{
+	if (!fpga->configured) {
+		memset(buf, 0xFF, 2);
+		return 2;
+	}
+	int words = (fpga->output_head - fpga->output_limit) / OUTPUT_WORD_WIDTH;
+	fpga->output_limit = fpga->output_head;
+	buf[0] = words;
+	buf[1] = words >> 8;
+	return 2;
+}
+
+
+// =======================================================================
+//
+// Board (firmware)
+//
+// =======================================================================
+
+static void emu_board_power_on(struct emu_board *board)
+{
+	board->firmware = emu_params.firmware;
+	board->cpu_reset = 0;
+	board->fw_bytes = 0;
+	board->hs_conf = 0;
+	board->selected_fpga = 0;
+	int i;
+	for (i = 0; i < board->num_of_fpgas; i++) {
+		board->fpga[i].configured = emu_params.bitstream;
+		emu_fpga_reset(&board->fpga[i]);
+	}
+}
+
+static struct emu_board *emu_board_new(int num)
+{
+	struct emu_board *board = calloc(1, sizeof(struct emu_board));
+	if (!board)
+		return NULL;
+	pthread_mutex_init(&board->lock, NULL);
+	board->num = num;
+	snprintf(board->sn, ZTEX_SNSTRING_LEN, "EMU%07d", num + 1);
+	board->num_of_fpgas = emu_params.num_fpgas;
+	int i;
+	for (i = 0; i < board->num_of_fpgas; i++)
+		if (emu_fpga_init(&board->fpga[i], i) < 0)
+			return NULL;
+	emu_board_power_on(board);
+	return board;
+}
+
+static void emu_board_delete(struct emu_board *board)
+{
+	int i;
+	for (i = 0; i < board->num_of_fpgas; i++)
+		emu_fpga_free(&board->fpga[i]);
+	pthread_mutex_destroy(&board->lock);
+	free(board);
+}
+
+// Board goes off the bus. It reappears on the next scan
+static void emu_board_disconnect(struct emu_board *board, int power_cycle)
+{
+	if (!board->usb_dev)
+		return;
+	board->usb_dev->gone = 1;
+	board->usb_dev = NULL;
+	board->power_cycle = power_cycle;
+}
+
+// Board lock must be held. Returns 0 if device isn't usable
+static int emu_board_transfer(struct emu_board *board, struct libusb_device *dev)
+{
+	if (dev->gone)
+		return 0;
+	board->transfer_count++;
+	if (emu_params.fail_after && !board->failed
+			&& board->transfer_count >= (uint64_t)emu_params.fail_after) {
+		fprintf(stderr, "Emulator: SN %s fails\n", board->sn);
+		board->failed = 1;
+		emu_board_disconnect(board, 1);
+		return 0;
+	}
+	return 1;
+}
+
+// Firmware fpga_select(): disables hs_io on previous FPGA,
+// enables on the selected one
+static void emu_board_select(struct emu_board *board, int num)
+{
+	if (num == board->selected_fpga)
+		return;
+	board->fpga[board->selected_fpga].hs_io_enable = 0;
+	board->selected_fpga = num;
+	board->fpga[num].hs_io_enable = 1;
+}
+
+// ZTEX-specific descriptor (VR 0x22)
+static int emu_ztex_descriptor(unsigned char *buf, int len)
+{
+	unsigned char desc[40] = {
+		40, 1, 'Z', 'T', 'E', 'X',
+		10, 15, 0, 0,	// productId: 1.15y
+		0, 1,			// fwVersion, interfaceVersion
+		// capabilities: EEPROM, FPGA, HS_FPGA, MULTI_FPGA
+		0x01 | 0x02 | 0x20 | 0x80, 0, 0, 0, 0, 0
+	};
+	if (len > (int)sizeof(desc))
+		len = sizeof(desc);
+	memcpy(buf, desc, len);
+	return len;
+}
+
+// Vendor requests and commands. Board lock must be held
+static int emu_board_control(struct emu_board *board, int request_type,
+		int request, int value, int index, unsigned char *buf, int len)
+{
+	struct emu_fpga *fpga = &board->fpga[board->selected_fpga];
+	unsigned char reply[9];
+	int reply_len = -1;
+	int i;
+
+	// EZ-USB: firmware upload, CPU reset
+	if (request == 0xA0 && request_type == 0x40) {
+		if (value == 0xE600 && len == 1) {
+			if (buf[0] & 1)
+				board->cpu_reset = 1;
+			else if (board->cpu_reset) {
+				board->cpu_reset = 0;
+				if (board->fw_bytes) {
+					// new firmware starts, device reenumerates
+					board->firmware = 1;
+					board->fw_bytes = 0;
+					emu_board_disconnect(board, 0);
+				}
+			}
+		}
+		else if (board->cpu_reset)
+			board->fw_bytes += len;
+		return len;
+	}
+
+	if (board->cpu_reset)
+		return LIBUSB_ERROR_PIPE;
+
+	switch (request) {
+	// ZTEX firmware kit
+	case 0x22:
+		return emu_ztex_descriptor(buf, len);
+	case 0x30: // getFpgaState
+		memset(reply, 0, 9);
+		reply[0] = !fpga->configured;
+		reply[2] = board->hs_conf_bytes;
+		reply[3] = board->hs_conf_bytes >> 8;
+		reply[4] = board->hs_conf_bytes >> 16;
+		reply[5] = board->hs_conf_bytes >> 24;
+		reply[6] = 1;
+		reply_len = 9;
+		break;
+	case 0x31: // resetFpga
+		fpga->configured = 0;
+		return 0;
+	case 0x33: // getHSFpgaSettings
+		reply[0] = EMU_HS_CONF_ENDPOINT;
+		reply[1] = 0;
+		reply_len = 2;
+		break;
+	case 0x34: // initHSFPGAConfiguration
+		fpga->configured = 0;
+		board->hs_conf = 1;
+		board->hs_conf_bytes = 0;
+		return 0;
+	case 0x35: // finishHSFPGAConfiguration
+		if (board->hs_conf && board->hs_conf_bytes) {
+			fpga->configured = 1;
+			emu_fpga_reset(fpga);
+		}
+		board->hs_conf = 0;
+		return 0;
+	case 0x50: // getMultiFpgaInfo
+		reply[0] = board->num_of_fpgas - 1;
+		reply[1] = board->selected_fpga;
+		reply[2] = 0;
+		reply_len = 3;
+		break;
+	case 0x51: // selectFpga
+		if (value >= board->num_of_fpgas)
+			return LIBUSB_ERROR_PIPE;
+		board->selected_fpga = value;
+		return 0;
+	}
+
+	if (reply_len >= 0) {
+		if (len > reply_len)
+			len = reply_len;
+		memcpy(buf, reply, len);
+		return len;
+	}
+
+	// inouttraffic firmware
+	if (!board->firmware)
+		return LIBUSB_ERROR_PIPE;
+
+	switch (request) {
+	case 0x80: // hs_io enable
+		fpga->hs_io_enable = !!value;
+		return 0;
+	case 0x82: // app_mode
+		emu_fpga_run(fpga);
+		fpga->app_mode = value;
+		return 0;
+	case 0x84:
+		emu_fpga_run(fpga);
+		reply_len = emu_fpga_get_io_state(fpga, reply);
+		break;
+	case 0x85:
+		emu_fpga_run(fpga);
+		reply_len = emu_fpga_reg_output_limit(fpga, reply);
+		break;
+	case 0x86: // output limit enable
+		fpga->output_limit_enable = !!value;
+		if (!value)
+			fpga->output_limit = fpga->output_head;
+		return 0;
+	case 0x88: // echo, FPGA id, bitstream type
+		if (!fpga->configured) {
+			memset(reply, 0xFF, 8);
+		}
+		else {
+			reply[0] = value ^ 0x5A;
+			reply[1] = value >> 8 ^ 0x5A;
+			reply[2] = index ^ 0x5A;
+			reply[3] = index >> 8 ^ 0x5A;
+			reply[4] = fpga->num;
+			reply[5] = 0;
+			reply[6] = EMU_BITSTREAM_TYPE & 0xFF;
+			reply[7] = EMU_BITSTREAM_TYPE >> 8;
+		}
+		reply_len = 8;
+		break;
+	case 0x8B: // reset: disable hs_io, GSR, reset EZ-USB FIFO, enable hs_io
+		emu_fpga_reset(fpga);
+		fpga->hs_io_enable = 1;
+		return 0;
+	case 0x8C: // select, get io_state, register output limit
+		if (value >= board->num_of_fpgas)
+			return LIBUSB_ERROR_PIPE;
+		emu_board_select(board, value);
+		fpga = &board->fpga[value];
+		emu_fpga_run(fpga);
+		emu_fpga_get_io_state(fpga, reply);
+		emu_fpga_reg_output_limit(fpga, reply + 6);
+		reply_len = 8;
+		break;
+	case 0x8E: // select
+		if (value >= board->num_of_fpgas)
+			return LIBUSB_ERROR_PIPE;
+		emu_board_select(board, value);
+		return 0;
+	default:
+		return LIBUSB_ERROR_PIPE;
+	}
+
+	if (len > reply_len)
+		len = reply_len;
+	for (i = 0; i < len; i++)
+		buf[i] = reply[i];
+	return len;
+}
+
+// Bulk transfers. Board lock must be held
+static int emu_board_bulk(struct emu_board *board, int endpoint,
+		unsigned char *buf, int len, int *transferred)
+{
+	struct emu_fpga *fpga = &board->fpga[board->selected_fpga];
+	int i;
+	*transferred = 0;
+
+	if (endpoint == EMU_HS_CONF_ENDPOINT && board->hs_conf) {
+		board->hs_conf_bytes += len;
+		*transferred = len;
+		return 0;
+	}
+
+	// Timeout: FPGA doesn't take or provide data
+	if (!board->firmware || !fpga->configured || !fpga->hs_io_enable)
+		return LIBUSB_ERROR_TIMEOUT;
+
+	if (endpoint == 0x06) {
+		int count = EMU_INPUT_FIFO_SIZE - emu_input_count(fpga);
+		if (count > len)
+			count = len;
+		for (i = 0; i < count; i++)
+			fpga->input[fpga->input_head++ % EMU_INPUT_FIFO_SIZE] = buf[i];
+		*transferred = count;
+		emu_fpga_run(fpga);
+		return count == len ? 0 : LIBUSB_ERROR_TIMEOUT;
+	}
+
+	if (endpoint == 0x82) {
+		int count = fpga->output_limit - fpga->output_tail;
+		if (count > len)
+			count = len;
+		for (i = 0; i < count; i++)
+			buf[i] = fpga->output[fpga->output_tail++ % EMU_OUTPUT_FIFO_SIZE];
+		*transferred = count;
+		return count ? 0 : LIBUSB_ERROR_TIMEOUT;
+	}
+
+	return LIBUSB_ERROR_PIPE;
+}
+
+void emu_print_stats()
+{
+	int i, j;
+	pthread_mutex_lock(&emu_lock);
+	for (i = 0; i < emu_num_boards; i++) {
+		struct emu_board *board = emu_board[i];
+		pthread_mutex_lock(&board->lock);
+		fprintf(stderr, "Emulator: SN %s: %llu transfers\n", board->sn,
+				(unsigned long long)board->transfer_count);
+		for (j = 0; j < board->num_of_fpgas; j++) {
+			struct emu_fpga *fpga = &board->fpga[j];
+			fprintf(stderr, "  FPGA #%d: %llu candidates, %llu matches,"
+				" pkt_comm_status 0x%02x, app_status 0x%02x\n", j,
+				(unsigned long long)fpga->candidate_count,
+				(unsigned long long)fpga->cmp_equal_count,
+				fpga->pkt_comm_status, fpga->app_status);
+		}
+		pthread_mutex_unlock(&board->lock);
+	}
+	pthread_mutex_unlock(&emu_lock);
+}
+
+
+// =======================================================================
+//
+// libusb functions
+//
+// =======================================================================
+
+static void emu_params_env(const char *name, int *param)
+{
+	char *value = getenv(name);
+	if (value)
+		*param = atoi(value);
+}
+
+int libusb_init(libusb_context **ctx)
+{
+	static int emu_ctx;
+	int i;
+
+	if (ctx)
+		*ctx = (libusb_context *)&emu_ctx;
+
+	pthread_mutex_lock(&emu_lock);
+	if (emu_init_count++) {
+		pthread_mutex_unlock(&emu_lock);
+		return 0;
+	}
+
+	emu_params_env("EMU_BOARDS", &emu_params.num_boards);
+	emu_params_env("EMU_FPGAS", &emu_params.num_fpgas);
+	emu_params_env("EMU_FIRMWARE", &emu_params.firmware);
+	emu_params_env("EMU_BITSTREAM", &emu_params.bitstream);
+	emu_params_env("EMU_COMPUTE", &emu_params.compute);
+	emu_params_env("EMU_FAIL_AFTER", &emu_params.fail_after);
+	emu_params_env("EMU_DRAIN_USEC", &emu_params.drain_usec);
+	if (getenv("EMU_RATE"))
+		emu_params.rate = strtoul(getenv("EMU_RATE"), NULL, 10);
+
+	if (emu_params.num_boards < 0 || emu_params.num_boards > EMU_BOARDS_MAX
+			|| emu_params.num_fpgas < 1 || emu_params.num_fpgas > DEVICE_FPGAS_MAX) {
+		fprintf(stderr, "Emulator: invalid parameters\n");
+		emu_init_count = 0;
+		pthread_mutex_unlock(&emu_lock);
+		return LIBUSB_ERROR_INVALID_PARAM;
+	}
+
+	for (i = 0; i < emu_params.num_boards; i++) {
+		emu_board[i] = emu_board_new(i);
+		if (!emu_board[i]) {
+			fprintf(stderr, "Emulator: unable to create board\n");
+			break;
+		}
+	}
+	emu_num_boards = i;
+	pthread_mutex_unlock(&emu_lock);
+	return 0;
+}
+
+void libusb_exit(libusb_context *ctx)
+{
+	(void)ctx;
+	int i;
+	pthread_mutex_lock(&emu_lock);
+	if (!emu_init_count || --emu_init_count) {
+		pthread_mutex_unlock(&emu_lock);
+		return;
+	}
+	for (i = 0; i < emu_num_boards; i++)
+		emu_board_delete(emu_board[i]);
+	emu_num_boards = 0;
+	while (emu_usb_devs) {
+		struct libusb_device *dev = emu_usb_devs;
+		emu_usb_devs = dev->next;
+		free(dev);
+	}
+	pthread_mutex_unlock(&emu_lock);
+}
+
+const char *libusb_strerror(int errcode)
+{
+	switch (errcode) {
+	case LIBUSB_SUCCESS: return "Success";
+	case LIBUSB_ERROR_IO: return "Input/Output Error";
+	case LIBUSB_ERROR_INVALID_PARAM: return "Invalid parameter";
+	case LIBUSB_ERROR_ACCESS: return "Access denied (insufficient permissions)";
+	case LIBUSB_ERROR_NO_DEVICE: return "No such device (it may have been disconnected)";
+	case LIBUSB_ERROR_NOT_FOUND: return "Entity not found";
+	case LIBUSB_ERROR_BUSY: return "Resource busy";
+	case LIBUSB_ERROR_TIMEOUT: return "Operation timed out";
+	case LIBUSB_ERROR_OVERFLOW: return "Overflow";
+	case LIBUSB_ERROR_PIPE: return "Pipe error";
+	case LIBUSB_ERROR_INTERRUPTED: return "System call interrupted (perhaps due to signal)";
+	case LIBUSB_ERROR_NO_MEM: return "Insufficient memory";
+	case LIBUSB_ERROR_NOT_SUPPORTED: return "Operation not supported or unimplemented on this platform";
+	}
+	return "Other error";
+}
+
+// Disconnected boards reappear as new devices
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	(void)ctx;
+	int i, count = 0;
+	pthread_mutex_lock(&emu_lock);
+	*list = calloc(emu_num_boards + 1, sizeof(libusb_device *));
+	if (!*list) {
+		pthread_mutex_unlock(&emu_lock);
+		return LIBUSB_ERROR_NO_MEM;
+	}
+
+	for (i = 0; i < emu_num_boards; i++) {
+		struct emu_board *board = emu_board[i];
+		pthread_mutex_lock(&board->lock);
+		if (!board->usb_dev) {
+			struct libusb_device *dev = calloc(1, sizeof(struct libusb_device));
+			if (dev) {
+				dev->board = board;
+				dev->devnum = ++board->devnum;
+				dev->next = emu_usb_devs;
+				emu_usb_devs = dev;
+				board->usb_dev = dev;
+				if (board->power_cycle)
+					emu_board_power_on(board);
+				board->power_cycle = 0;
+			}
+		}
+		if (board->usb_dev)
+			(*list)[count++] = board->usb_dev;
+		pthread_mutex_unlock(&board->lock);
+	}
+	pthread_mutex_unlock(&emu_lock);
+	return count;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+	(void)unref_devices;
+	free(list);
+}
+
+libusb_device *libusb_ref_device(libusb_device *dev)
+{
+	return dev;
+}
+
+void libusb_unref_device(libusb_device *dev)
+{
+	(void)dev;
+}
+
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+	(void)dev;
+	memset(desc, 0, sizeof(*desc));
+	desc->bLength = 18;
+	desc->bDescriptorType = 1;
+	desc->bcdUSB = 0x0200;
+	desc->bMaxPacketSize0 = 64;
+	desc->idVendor = ZTEX_IDVENDOR;
+	desc->idProduct = ZTEX_IDPRODUCT;
+	desc->iManufacturer = 1;
+	desc->iProduct = 2;
+	desc->iSerialNumber = 3;
+	desc->bNumConfigurations = 1;
+	return 0;
+}
+
+uint8_t libusb_get_bus_number(libusb_device *dev)
+{
+	(void)dev;
+	return 1;
+}
+
+uint8_t libusb_get_device_address(libusb_device *dev)
+{
+	return dev->board->num * 16 + dev->devnum % 16 + 1;
+}
+
+int libusb_open(libusb_device *dev, libusb_device_handle **handle)
+{
+	struct emu_board *board = dev->board;
+	int result = 0;
+	pthread_mutex_lock(&board->lock);
+	if (dev->gone)
+		result = LIBUSB_ERROR_NO_DEVICE;
+	else if ( !(*handle = malloc(sizeof(libusb_device_handle))) )
+		result = LIBUSB_ERROR_NO_MEM;
+	else
+		(*handle)->dev = dev;
+	pthread_mutex_unlock(&board->lock);
+	return result;
+}
+
+void libusb_close(libusb_device_handle *handle)
+{
+	free(handle);
+}
+
+int libusb_claim_interface(libusb_device_handle *handle, int interface_number)
+{
+	(void)interface_number;
+	return handle->dev->gone ? LIBUSB_ERROR_NO_DEVICE : 0;
+}
+
+int libusb_release_interface(libusb_device_handle *handle, int interface_number)
+{
+	(void)interface_number;
+	return handle->dev->gone ? LIBUSB_ERROR_NO_DEVICE : 0;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle *handle,
+		uint8_t desc_index, unsigned char *data, int length)
+{
+	struct emu_board *board = handle->dev->board;
+	const char *str;
+	pthread_mutex_lock(&board->lock);
+	if (handle->dev->gone) {
+		pthread_mutex_unlock(&board->lock);
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+	str = desc_index == 1 ? "ZTEX"
+		: desc_index == 2 ? (board->firmware ? "inouttraffic UFM 1.15y"
+			: "USB-FPGA Module 1.15y (default)")
+		: desc_index == 3 ? board->sn
+		: NULL;
+	int len = str ? snprintf((char *)data, length, "%s", str) : LIBUSB_ERROR_INVALID_PARAM;
+	pthread_mutex_unlock(&board->lock);
+	return len < length ? len : length - 1;
+}
+
+int libusb_control_transfer(libusb_device_handle *handle, uint8_t request_type,
+		uint8_t request, uint16_t value, uint16_t index,
+		unsigned char *data, uint16_t length, unsigned int timeout)
+{
+	(void)timeout;
+	struct emu_board *board = handle->dev->board;
+	int result;
+	pthread_mutex_lock(&board->lock);
+	if (!emu_board_transfer(board, handle->dev))
+		result = LIBUSB_ERROR_NO_DEVICE;
+	else
+		result = emu_board_control(board, request_type, request, value, index,
+				data, length);
+	pthread_mutex_unlock(&board->lock);
+	return result;
+}
+
+int libusb_bulk_transfer(libusb_device_handle *handle, unsigned char endpoint,
+		unsigned char *data, int length, int *transferred, unsigned int timeout)
+{
+	(void)timeout;
+	struct emu_board *board = handle->dev->board;
+	int result;
+	pthread_mutex_lock(&board->lock);
+	if (!emu_board_transfer(board, handle->dev)) {
+		*transferred = 0;
+		result = LIBUSB_ERROR_NO_DEVICE;
+	}
+	else
+		result = emu_board_bulk(board, endpoint, data, length, transferred);
+	pthread_mutex_unlock(&board->lock);
+	return result;
+}
@@ -0,0 +1,162 @@
+//===============================================================
+//
+// Software emulator of ZTEX USB-FPGA Module 1.15y boards
+// with inouttraffic firmware and descrypt bitstream.
+//
+// * emulator.c implements libusb functions used by the host code.
+//   Program linked with emulator.c instead of libusb-1.0 finds
+//   emulated boards: scan, firmware and bitstream upload, vendor
+//   requests (inouttraffic.c firmware) and bulk I/O (EP 0x06, 0x82)
+//   go to the emulator.
+// * Each FPGA models pkt_comm (input packets, error flags in
+//   pkt_comm_status), word_list, word_gen, cmp_config and the
+//   descrypt arbiter: CMP_EQUAL and PROCESSING_DONE output packets.
+//   Hashes are computed with crypt_r(3).
+// * FPGAs advance lazily: when the host accesses an FPGA, it
+//   processes candidates for the time passed since the last access
+//   (at emu_params.rate candidates/s). Generation stalls when
+//   output FIFO is full, input stalls while word generator is busy.
+// * CMP_CONFIG idles the FPGA for emu_params.drain_usec (arbiter
+//   waits for all cores to finish), if the rate is set.
+// * Boards can fail after some number of transfers and reappear
+//   on the next scan as new USB devices (recovery tests).
+//
+// Parameters can be set before libusb_init() or with environment
+// variables EMU_BOARDS, EMU_FPGAS, EMU_FIRMWARE, EMU_BITSTREAM,
+// EMU_RATE, EMU_COMPUTE, EMU_FAIL_AFTER, EMU_DRAIN_USEC.
+//
+//===============================================================
+
+#include <pthread.h>
+
+#define EMU_BOARDS_MAX	16
+
+// hardcoded into bitstream (vcr.v/BITSTREAM_TYPE)
+#define EMU_BITSTREAM_TYPE	1
+// ENABLE_HS_FPGA_CONF(6)
+#define EMU_HS_CONF_ENDPOINT	6
+
+// Input FIFO. INPUT_PROG_FULL is asserted when there's less
+// than EMU_INPUT_PROG_FULL_GAP bytes of free space
+#define EMU_INPUT_FIFO_SIZE	65536
+#define EMU_INPUT_PROG_FULL_GAP	16384
+// Output FIFO (output_limit_fifo.v, ADDR_MSB 11) holds 1 word less
+#define EMU_OUTPUT_FIFO_SIZE	8192
+#define EMU_OUTPUT_FIFO_MAX		(EMU_OUTPUT_FIFO_SIZE - OUTPUT_WORD_WIDTH)
+
+// Candidates per FPGA access if rate is not limited and hashes
+// are computed (otherwise all pending candidates are counted at once)
+#define EMU_RUN_BATCH	1024
+// At most that much time is accounted for per FPGA access
+#define EMU_RUN_MAX_USEC	100000
+
+// pkt_comm_status (pkt_comm_arbiter.v)
+#define EMU_ERR_INPKT_CHECKSUM	0x01
+#define EMU_ERR_INPKT_LEN		0x02
+#define EMU_ERR_INPKT_TYPE		0x04
+#define EMU_ERR_PKT_VERSION		0x08
+#define EMU_ERR_WORD_LIST_COUNT	0x10
+#define EMU_ERR_WORD_LIST_LEN	0x20
+#define EMU_ERR_WORD_GEN_CONF	0x40
+#define EMU_ERR_CMP_CONFIG		0x80
+// app_status (arbiter.v)
+#define EMU_ERR_CMP_NO_CONF		0x01
+
+struct emu_params {
+	int num_boards;
+	int num_fpgas;
+	int firmware;		// boards come up with inouttraffic firmware
+	int bitstream;		// FPGAs come up configured
+	unsigned long rate;	// candidates/s per FPGA, 0: as fast as computed
+	int compute;		// compute hashes; if not, only count candidates
+	int fail_after;		// each board fails once after that many transfers
+	int drain_usec;		// FPGA is idle after CMP_CONFIG
+};
+
+extern struct emu_params emu_params;
+
+// Word generator state
+#define EMU_GEN_IDLE	0
+#define EMU_GEN_WORD	1	// waits for a word from word_list
+#define EMU_GEN_RUN		2
+#define EMU_GEN_DONE	3	// PROCESSING_DONE waits for output
+
+struct emu_fpga {
+	int num;
+	int configured;			// bitstream loaded
+	int hs_io_enable;
+	int output_limit_enable;
+	unsigned char app_mode;
+	unsigned char app_status;
+	unsigned char pkt_comm_status;
+
+	// input FIFO
+	unsigned char *input;
+	unsigned int input_head, input_tail;
+	// input packet
+	unsigned char inpkt_header[PKT_HEADER_LEN + PKT_CHECKSUM_LEN];
+	int inpkt_header_len;
+	unsigned char *inpkt_data;	// data and checksum
+	int inpkt_len;				// data length from the header
+	int inpkt_data_len;			// received data and checksum
+	int inpkt_ready;			// waits for processing
+
+	// output FIFO
+	unsigned char *output;
+	unsigned int output_head, output_tail;
+	unsigned int output_limit;	// host reads up to that position
+
+	// word_list
+	unsigned char *word_list;
+	int word_list_len;			// 0 if no word list
+	int word_list_offset;
+	unsigned short word_list_id;
+
+	// word_gen
+	struct word_gen word_gen;
+	unsigned short gen_pkt_id;
+	int gen_state;
+	unsigned char gen_idx[RANGES_MAX];
+	uint64_t gen_left;			// candidates left for the current word
+	unsigned int gen_id;
+	unsigned char word[WORD_MAX_LEN];
+	int word_len;
+	unsigned short word_id;
+	int word_list_end;
+	unsigned int num_processed;
+
+	// cmp_config
+	int cmp_configured;
+	int num_hashes;
+	uint64_t hash[CMP_CONFIG_NUM_HASHES_MAX];
+	char salt[3];
+	struct crypt_data *crypt_data;
+
+	uint64_t run_usec;			// last access
+	double credit;				// candidates due
+	double drain;				// candidates not processed (drain after CMP_CONFIG)
+	uint64_t candidate_count;
+	uint64_t cmp_equal_count;
+};
+
+struct emu_board {
+	pthread_mutex_t lock;	// board state, held during transfers
+	int num;
+	char sn[ZTEX_SNSTRING_LEN];
+	struct libusb_device *usb_dev;	// NULL while disconnected
+	int devnum;
+	int power_cycle;		// comes up in initial state on reconnect
+	int firmware;			// inouttraffic firmware is running
+	int cpu_reset;			// CPU is held in reset (firmware upload)
+	int fw_bytes;
+	int hs_conf;			// HS FPGA configuration in progress
+	int hs_conf_bytes;
+	int selected_fpga;
+	int num_of_fpgas;
+	uint64_t transfer_count;
+	int failed;
+	struct emu_fpga fpga[DEVICE_FPGAS_MAX];
+};
+
+// Prints per-board counters
+void emu_print_stats();
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "pkt_comm/pkt_comm.h"
+#include "pkt_comm/word_gen.h"
+#include "pkt_comm/word_list.h"
+#include "pkt_comm/mask.h"
+#include "hybrid.h"
+
+struct hybrid *hybrid_new(struct mask *mask, struct word_list_stream *stream,
+		struct pkt_pool *pool)
+{
+	if (mask->insert_pos == -1) {
+		fprintf(stderr, "hybrid_new(): mask has no word insertion point\n");
+		return NULL;
+	}
+
+	struct hybrid *hybrid = calloc(1, sizeof(struct hybrid));
+	if (!hybrid) {
+		fprintf(stderr, "hybrid_new(): unable to allocate %d bytes\n",
+				(int)sizeof(struct hybrid));
+		return NULL;
+	}
+	hybrid->mask = mask;
+	hybrid->stream = stream;
+	hybrid->pool = pool;
+	hybrid->expansion = mask_count(mask);
+	return hybrid;
+}
+
+void hybrid_delete(struct hybrid *hybrid)
+{
+	if (hybrid->word_list)
+		pkt_delete(hybrid->word_list);
+	free(hybrid);
+}
+
+// Word list is sent with each configuration
+static struct pkt *hybrid_word_list_copy(struct hybrid *hybrid)
+{
+	struct pkt *word_list = hybrid->word_list;
+	char *data = pkt_pool_alloc(hybrid->pool, word_list->data_len);
+	if (!data) {
+		fprintf(stderr, "hybrid_next(): unable to allocate %d bytes\n",
+				word_list->data_len);
+		return NULL;
+	}
+	memcpy(data, word_list->data, word_list->data_len);
+	struct pkt *pkt = pkt_new_pool(hybrid->pool, PKT_TYPE_WORD_LIST,
+			data, word_list->data_len);
+	if (!pkt) {
+		if (hybrid->pool)
+			pkt_pool_free(data);
+		else
+			free(data);
+	}
+	return pkt;
+}
+
+// Size of WORD_GEN packet (same as pkt_word_gen_new() creates)
+static int hybrid_word_gen_size(struct word_gen *word_gen)
+{
+	int size = 1 + word_gen->num_words + 4 + 1 + 1;
+	int i;
+	for (i = 0; i < word_gen->num_ranges; i++)
+		size += 2 + word_gen->ranges[i].num_chars;
+	return size;
+}
+
+int hybrid_next(struct hybrid *hybrid, uint64_t count,
+		struct word_gen *word_gen, struct pkt **word_list, size_t *offset)
+{
+	int i;
+	if (!hybrid->word_list) {
+		uint64_t words = count / hybrid->expansion;
+		if (!words)
+			words = 1;
+		word_list_stream_set_max_words(hybrid->stream,
+				words > WORD_LIST_WORDS_MAX ? WORD_LIST_WORDS_MAX : (int)words);
+
+		unsigned long long word_count = hybrid->stream->word_count;
+		hybrid->word_list = word_list_stream_next_pool(hybrid->stream,
+				hybrid->pool, &hybrid->offset);
+		if (!hybrid->word_list)
+			return 0;
+		hybrid->num_words = hybrid->stream->word_count - word_count;
+		mask_rewind(hybrid->mask);
+	}
+
+	mask_next(hybrid->mask, word_gen);
+	if (hybrid->mask->done) {
+		*word_list = hybrid->word_list;
+		hybrid->word_list = NULL;
+	}
+	else {
+		*word_list = hybrid_word_list_copy(hybrid);
+		if (!*word_list)
+			return 0;
+	}
+	*offset = hybrid->offset;
+
+	unsigned long long gen_count = word_gen->num_generate;
+	if (!gen_count) {
+		gen_count = 1;
+		for (i = 0; i < word_gen->num_ranges; i++)
+			gen_count *= word_gen->ranges[i].num_chars;
+	}
+	hybrid->candidate_count += gen_count * hybrid->num_words;
+	hybrid->byte_count += hybrid_word_gen_size(word_gen) + (*word_list)->data_len
+			+ 2 * (PKT_HEADER_LEN + 2 * PKT_CHECKSUM_LEN);
+	return 1;
+}
+
+void hybrid_seek(struct hybrid *hybrid, size_t offset)
+{
+	if (hybrid->word_list) {
+		pkt_delete(hybrid->word_list);
+		hybrid->word_list = NULL;
+	}
+	word_list_stream_seek(hybrid->stream, offset);
+}
+
+int hybrid_end(struct hybrid *hybrid)
+{
+	return !hybrid->word_list && word_list_stream_end(hybrid->stream);
+}
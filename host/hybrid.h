@@ -0,0 +1,56 @@
+//===============================================================
+//
+// Hybrid attack: words from the word list with mask expansion.
+//
+// * Mask has word insertion point (?w), e.g. "?w?d?d" (suffix)
+//   or "?d?d?w" (prefix). Each word from the word list gets all
+//   candidates of the mask.
+// * Word list is streamed in packets, each WORD_LIST packet
+//   follows WORD_GEN packet with the mask configuration. If mask
+//   compiles into several configurations, words are sent with
+//   each one.
+// * Number of words in a packet is the number of candidates
+//   requested (e.g. from FPGA's work queue, so the packet takes
+//   the target time) divided by the mask expansion (candidates
+//   per word). With small expansion, packets are up to max. size,
+//   with large expansion packets are smaller (FPGA doesn't wait
+//   for a large packet to transmit, scheduling is finer-grained).
+//
+//===============================================================
+
+struct hybrid {
+	struct mask *mask;
+	struct word_list_stream *stream;
+	struct pkt_pool *pool;
+	unsigned long long expansion;	// candidates per word
+	// current word list, it's sent with each mask configuration
+	struct pkt *word_list;
+	size_t offset;
+	int num_words;
+	// candidates generated, bytes sent (including packet headers)
+	unsigned long long candidate_count;
+	unsigned long long byte_count;
+};
+
+// Mask must have word insertion point. Mask and the stream
+// aren't deleted with hybrid_delete(). WORD_LIST packets are
+// allocated from 'pool' (heap if NULL)
+struct hybrid *hybrid_new(struct mask *mask, struct word_list_stream *stream,
+		struct pkt_pool *pool);
+
+void hybrid_delete(struct hybrid *hybrid);
+
+// Sets next WORD_GEN configuration and WORD_LIST packet.
+// 'count' is the number of candidates for the words of the packet
+// (with all mask configurations), 'offset' is set to the position
+// of the words in the word list.
+// Returns 0 if there are no more words
+int hybrid_next(struct hybrid *hybrid, uint64_t count,
+		struct word_gen *word_gen, struct pkt **word_list, size_t *offset);
+
+// Continues from the given word list position
+// (packets that weren't processed are sent again)
+void hybrid_seek(struct hybrid *hybrid, size_t offset);
+
+// Returns true if there are no more words
+int hybrid_end(struct hybrid *hybrid);
@@ -81,6 +81,7 @@ struct device *device_new(struct ztex_device *ztex_device)
 	device->num_of_fpgas = ztex_device->num_of_fpgas;
 	device->selected_fpga = ztex_device->selected_fpga;
 	device->num_of_valid_fpgas = 0;
+	device->worker = NULL;
 
 	int i;
 	for (i = 0; i < device->num_of_fpgas; i++) {
@@ -96,6 +97,7 @@ struct device *device_new(struct ztex_device *ztex_device)
 		device->fpga[i].cmd_count = 0;
 		// packet-based communication
 		device->fpga[i].comm = NULL;
+		device->fpga[i].job = NULL;
 	}
 
 	int result;
@@ -695,6 +697,7 @@ int fpga_pkt_read(struct fpga *fpga)
 		}
 		else if (result == 0) { // Nothing to read
 			if (DEBUG) printf("#%d read_limit==0\n", fpga->num);
+			rd->read_limit = 0;
 			return 0;
 		}
 		rd->read_limit = result;
@@ -711,11 +714,12 @@ int fpga_pkt_read(struct fpga *fpga)
 		return 0;
 	
 	current_read_limit = rd->read_limit;
+	int offset = 0;
 	for ( ; ; ) {
 		int transferred = 0;
 		//result = libusb_bulk_transfer(fpga->device->handle, 0x82, rd->buf,
 		//		current_read_limit, &transferred, USB_RW_TIMEOUT);
-		result = libusb_bulk_transfer(fpga->device->handle, 0x82, input_buf,
+		result = libusb_bulk_transfer(fpga->device->handle, 0x82, input_buf + offset,
 				current_read_limit, &transferred, USB_RW_TIMEOUT);
 		if (DEBUG) printf("#%d usb_bulk_read(): result=%d, transferred=%d, current_read_limit=%d\n",
 			fpga->num, result, transferred, current_read_limit);
@@ -729,6 +733,7 @@ int fpga_pkt_read(struct fpga *fpga)
 			if (DEBUG) printf("#%d PARTIAL READ: %d of %d\n",
 				fpga->num, transferred, current_read_limit);
 			current_read_limit -= transferred;
+			offset += transferred;
 			rd->partial_read_count++;
 			continue;
 		}
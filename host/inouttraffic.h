@@ -106,6 +106,8 @@ struct fpga {
 	uint64_t data_out,data_in; // specific for advanced_test.c
 	
 	struct pkt_comm *comm;
+	// job scheduler state, NULL if none
+	struct job_fpga *job;
 };
 
 struct device {
@@ -117,6 +119,8 @@ struct device {
 	int num_of_valid_fpgas; // actually not used; on a valid device all FPGA's are OK
 	int num_of_fpgas;
 	int selected_fpga;
+	// I/O thread that owns the device, NULL if none
+	struct board_worker *worker;
 };
 
 struct device_list {
@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pkt_comm/pkt_comm.h"
+#include "pkt_comm/word_gen.h"
+#include "pkt_comm/cmp_config.h"
+#include "work_queue.h"
+#include "keyspace.h"
+#include "des_bs.h"
+#include "job.h"
+
+struct job *job_new(struct word_gen *word_gen, struct pkt_pool *pool)
+{
+	struct keyspace *keyspace = keyspace_new(word_gen);
+	if (!keyspace)
+		return NULL;
+
+	struct job *job = calloc(1, sizeof(struct job));
+	if (!job) {
+		fprintf(stderr, "job_new(): unable to allocate %d bytes\n",
+				(int)sizeof(struct job));
+		keyspace_delete(keyspace);
+		return NULL;
+	}
+	job->word_gen = *word_gen;
+	job->pool = pool;
+	job->keyspace_count = keyspace_remaining(keyspace);
+	job->drain_usec = JOB_DRAIN_USEC_INITIAL;
+	keyspace_delete(keyspace);
+	return job;
+}
+
+void job_delete(struct job *job)
+{
+	int i;
+	for (i = 0; i < JOB_NUM_SALTS; i++)
+		free(job->salt_hash[i]);
+	for (i = 0; i < job->num_groups; i++) {
+		if (job->group[i]->keyspace)
+			keyspace_delete(job->group[i]->keyspace);
+		free(job->group[i]);
+	}
+	free(job->group);
+	for (i = 0; i < job->num_fpgas; i++)
+		free(job->fpga[i]);
+	free(job->fpga);
+	free(job);
+}
+
+static int job_salt_append(struct job *job, int salt, uint64_t hash)
+{
+	if (job->salt_count[salt] == job->salt_size[salt]) {
+		int size = job->salt_size[salt] ? job->salt_size[salt] * 2 : 16;
+		uint64_t *salt_hash = realloc(job->salt_hash[salt], size * sizeof(uint64_t));
+		if (!salt_hash) {
+			fprintf(stderr, "job_salt_append(): unable to allocate %d bytes\n",
+					(int)(size * sizeof(uint64_t)));
+			return -1;
+		}
+		job->salt_hash[salt] = salt_hash;
+		job->salt_size[salt] = size;
+	}
+	job->salt_hash[salt][ job->salt_count[salt]++ ] = hash;
+	return 0;
+}
+
+int job_add_hash(struct job *job, char *str)
+{
+	int salt;
+	uint64_t hash;
+	if (des_bs_decode(str, &salt, &hash) < 0)
+		return -1;
+	return job_salt_append(job, salt, hash);
+}
+
+// Hash of the line, "login:hash[:...]" or "hash"
+static void job_load_line(struct job *job, char *line, char *end)
+{
+	char *str = memchr(line, ':', end - line);
+	str = str ? str + 1 : line;
+	char *hash_end = memchr(str, ':', end - str);
+	if (!hash_end)
+		hash_end = end;
+	if (hash_end > str && hash_end[-1] == '\r')
+		hash_end--;
+	if (hash_end - str != 13 || job_add_hash(job, str) < 0)
+		job->num_bad_lines++;
+}
+
+int job_load(struct job *job, char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	if (!st.st_size) {
+		close(fd);
+		return 0;
+	}
+
+	char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	char *ptr = data, *end = data + st.st_size;
+	while (ptr < end) {
+		char *line_end = memchr(ptr, '\n', end - ptr);
+		if (!line_end)
+			line_end = end;
+		if (line_end > ptr)
+			job_load_line(job, ptr, line_end);
+		ptr = line_end + 1;
+	}
+	munmap(data, st.st_size);
+	close(fd);
+	return 0;
+}
+
+// LSD radix sort, 8 bits per pass. Passes where all hashes have
+// the same byte are skipped
+static int job_sort(uint64_t *hash, int count)
+{
+	int i, j, byte;
+	if (count < 64) {
+		for (i = 1; i < count; i++) {
+			uint64_t value = hash[i];
+			for (j = i; j > 0 && hash[j - 1] > value; j--)
+				hash[j] = hash[j - 1];
+			hash[j] = value;
+		}
+		return 0;
+	}
+
+	uint64_t *tmp = malloc(count * sizeof(uint64_t));
+	if (!tmp) {
+		fprintf(stderr, "job_start(): unable to allocate %d bytes\n",
+				(int)(count * sizeof(uint64_t)));
+		return -1;
+	}
+	// histograms of all the bytes in one pass
+	int offset[8][256];
+	memset(offset, 0, sizeof(offset));
+	for (i = 0; i < count; i++)
+		for (byte = 0; byte < 8; byte++)
+			offset[byte][hash[i] >> (byte * 8) & 0xff]++;
+
+	uint64_t *src = hash, *dst = tmp;
+	for (byte = 0; byte < 8; byte++) {
+		if (offset[byte][hash[0] >> (byte * 8) & 0xff] == count)
+			continue;
+		int sum = 0;
+		for (i = 0; i < 256; i++) {
+			int n = offset[byte][i];
+			offset[byte][i] = sum;
+			sum += n;
+		}
+		for (i = 0; i < count; i++)
+			dst[ offset[byte][src[i] >> (byte * 8) & 0xff]++ ] = src[i];
+		uint64_t *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != hash)
+		memcpy(hash, src, count * sizeof(uint64_t));
+	free(tmp);
+	return 0;
+}
+
+static struct job_group *job_group_new(int salt, uint64_t *hash, int num_hashes)
+{
+	struct job_group *group = calloc(1, sizeof(struct job_group));
+	if (!group) {
+		fprintf(stderr, "job_start(): unable to allocate %d bytes\n",
+				(int)sizeof(struct job_group));
+		return NULL;
+	}
+	group->cmp_config.salt = salt;
+	group->cmp_config.num_hashes = num_hashes;
+	int i, j;
+	for (i = 0; i < num_hashes; i++)
+		for (j = 0; j < CMP_CONFIG_HASH_LEN; j++)
+			group->cmp_config.cmp_hash[i].b[j] = hash[i] >> (8 * j);
+	return group;
+}
+
+int job_start(struct job *job)
+{
+	int salt, i;
+
+	// Sort, remove duplicates, count groups
+	int num_groups = 0;
+	for (salt = 0; salt < JOB_NUM_SALTS; salt++) {
+		int count = job->salt_count[salt];
+		if (!count)
+			continue;
+		uint64_t *hash = job->salt_hash[salt];
+		if (job_sort(hash, count) < 0)
+			return -1;
+		int unique = 1;
+		for (i = 1; i < count; i++)
+			if (hash[i] != hash[unique - 1])
+				hash[unique++] = hash[i];
+		job->num_duplicates += count - unique;
+		job->num_hashes += unique;
+		job->salt_count[salt] = unique;
+		num_groups += (unique + CMP_CONFIG_NUM_HASHES_MAX - 1)
+				/ CMP_CONFIG_NUM_HASHES_MAX;
+	}
+	if (!num_groups) {
+		fprintf(stderr, "job_start(): no hashes\n");
+		return -1;
+	}
+
+	job->group = malloc(num_groups * sizeof(struct job_group *));
+	if (!job->group) {
+		fprintf(stderr, "job_start(): unable to allocate memory\n");
+		return -1;
+	}
+
+	// Groups of the same salt are of about the same size
+	for (salt = 0; salt < JOB_NUM_SALTS; salt++) {
+		int count = job->salt_count[salt];
+		job->salt_group[salt] = count ? job->num_groups : -1;
+		if (!count)
+			continue;
+		int salt_groups = (count + CMP_CONFIG_NUM_HASHES_MAX - 1)
+				/ CMP_CONFIG_NUM_HASHES_MAX;
+		int start = 0;
+		for (i = 0; i < salt_groups; i++) {
+			int end = (int)((long long)count * (i + 1) / salt_groups);
+			struct job_group *group = job_group_new(salt,
+					job->salt_hash[salt] + start, end - start);
+			if (!group)
+				return -1;
+			job->group[job->num_groups++] = group;
+			start = end;
+		}
+		free(job->salt_hash[salt]);
+		job->salt_hash[salt] = NULL;
+		job->salt_count[salt] = job->salt_size[salt] = 0;
+	}
+	return 0;
+}
+
+struct job_fpga *job_fpga_new(struct job *job)
+{
+	struct job_fpga **fpga = realloc(job->fpga,
+			(job->num_fpgas + 1) * sizeof(struct job_fpga *));
+	if (!fpga) {
+		fprintf(stderr, "job_fpga_new(): unable to allocate memory\n");
+		return NULL;
+	}
+	job->fpga = fpga;
+
+	struct job_fpga *job_fpga = calloc(1, sizeof(struct job_fpga));
+	if (!job_fpga) {
+		fprintf(stderr, "job_fpga_new(): unable to allocate memory\n");
+		return NULL;
+	}
+	job_fpga->group = -1;
+	job_fpga->reconfig_pkt_id = -1;
+	job->fpga[job->num_fpgas++] = job_fpga;
+	return job_fpga;
+}
+
+void job_fpga_delete(struct job *job, struct job_fpga *fpga)
+{
+	int i;
+	job_fpga_unconfigure(job, fpga);
+	for (i = 0; i < job->num_fpgas; i++)
+		if (job->fpga[i] == fpga)
+			break;
+	if (i == job->num_fpgas)
+		return;
+	job->fpga[i] = job->fpga[--job->num_fpgas];
+	free(fpga);
+}
+
+static uint64_t job_group_remaining(struct job *job, struct job_group *group)
+{
+	if (group->done)
+		return 0;
+	return group->keyspace ? keyspace_remaining(group->keyspace)
+			: job->keyspace_count;
+}
+
+// Group with most remaining candidates per FPGA, -1 if none
+static int job_select_group(struct job *job)
+{
+	int best = -1;
+	double best_remaining = 0;
+	int i;
+	for (i = 0; i < job->num_groups; i++) {
+		struct job_group *group = job->group[i];
+		uint64_t remaining = job_group_remaining(job, group);
+		if (!remaining)
+			continue;
+		double per_fpga = (double)remaining / (group->num_fpgas + 1);
+		if (per_fpga > best_remaining) {
+			best = i;
+			best_remaining = per_fpga;
+		}
+	}
+	return best;
+}
+
+// Groups of the salt that aren't started yet are repacked with hashes
+// not yet cracked, so the keyspace runs fewer times for the salt.
+// Returns 1 if the number of groups was reduced
+static int job_repack_salt(struct job *job, int salt)
+{
+	int first = job->salt_group[salt], num, i;
+	int count = 0, num_unstarted = 0;
+	for (num = first; num < job->num_groups
+			&& job->group[num]->cmp_config.salt == salt; num++) {
+		struct job_group *group = job->group[num];
+		if (group->keyspace || group->done)
+			continue;
+		num_unstarted++;
+		count += group->cmp_config.num_hashes - group->num_cracked;
+	}
+	int needed = (count + CMP_CONFIG_NUM_HASHES_MAX - 1)
+			/ CMP_CONFIG_NUM_HASHES_MAX;
+	if (needed >= num_unstarted)
+		return 0;
+
+	// Unstarted groups are in ascending order, so are their hashes
+	struct cmp_hash *hash = malloc(count * sizeof(struct cmp_hash));
+	if (!hash) {
+		fprintf(stderr, "job_repack_salt(): unable to allocate %d bytes\n",
+				(int)(count * sizeof(struct cmp_hash)));
+		return 0;
+	}
+	count = 0;
+	for (num = first; num < job->num_groups
+			&& job->group[num]->cmp_config.salt == salt; num++) {
+		struct job_group *group = job->group[num];
+		if (group->keyspace || group->done)
+			continue;
+		for (i = 0; i < group->cmp_config.num_hashes; i++) {
+			if (!group->cracked[i])
+				hash[count++] = group->cmp_config.cmp_hash[i];
+			// Cracked hashes are kept for duplicate results
+			else
+				job_salt_append(job, salt,
+						des_bs_cmp_hash(&group->cmp_config.cmp_hash[i]));
+		}
+	}
+	job_sort(job->salt_hash[salt], job->salt_count[salt]);
+
+	int k = 0, start = 0;
+	for (num = first; num < job->num_groups
+			&& job->group[num]->cmp_config.salt == salt; num++) {
+		struct job_group *group = job->group[num];
+		if (group->keyspace || group->done)
+			continue;
+		memset(group->cracked, 0, sizeof(group->cracked));
+		group->num_cracked = 0;
+		if (k < needed) {
+			int end = (int)((long long)count * (k + 1) / needed);
+			memcpy(group->cmp_config.cmp_hash, hash + start,
+					(end - start) * sizeof(struct cmp_hash));
+			group->cmp_config.num_hashes = end - start;
+			start = end;
+			k++;
+		}
+		else {
+			group->cmp_config.num_hashes = 0;
+			group->done = 1;
+			job->num_groups_done++;
+			job->num_merged++;
+		}
+	}
+	free(hash);
+	return 1;
+}
+
+// CMP_CONFIG packet with hashes not yet cracked
+static struct pkt *job_group_config_pkt(struct job *job, struct job_group *group)
+{
+	if (!group->num_cracked)
+		return pkt_cmp_config_new_pool(job->pool, &group->cmp_config);
+
+	struct cmp_config *cmp_config = malloc(sizeof(struct cmp_config));
+	if (!cmp_config) {
+		fprintf(stderr, "job_fpga_next(): unable to allocate %d bytes\n",
+				(int)sizeof(struct cmp_config));
+		return NULL;
+	}
+	cmp_config->salt = group->cmp_config.salt;
+	cmp_config->num_hashes = 0;
+	int i;
+	for (i = 0; i < group->cmp_config.num_hashes; i++)
+		if (!group->cracked[i])
+			cmp_config->cmp_hash[ cmp_config->num_hashes++ ]
+				= group->cmp_config.cmp_hash[i];
+	struct pkt *pkt = pkt_cmp_config_new_pool(job->pool, cmp_config);
+	free(cmp_config);
+	return pkt;
+}
+
+static void job_fpga_configured(struct job_fpga *fpga, struct job_group *group,
+		unsigned short pkt_id)
+{
+	fpga->num_cracked = group->num_cracked;
+	fpga->num_dup_results = 0;
+	fpga->reconfig_pkt_id = pkt_id;
+	fpga->num_reconfigs++;
+}
+
+uint64_t job_chunk_usec(struct job *job)
+{
+	uint64_t chunk_usec = job->drain_usec * JOB_SWITCH_RATIO;
+	return chunk_usec > WORK_QUEUE_USEC ? chunk_usec : WORK_QUEUE_USEC;
+}
+
+int job_fpga_next(struct job *job, struct job_fpga *fpga,
+		unsigned short pkt_id, struct word_gen *word_gen,
+		struct pkt **cmp_config)
+{
+	*cmp_config = NULL;
+	if (work_queue_full(&fpga->queue))
+		return 0;
+
+	struct job_group *group = fpga->group == -1 ? NULL : job->group[fpga->group];
+	if (!group || !job_group_remaining(job, group)) {
+		int num = job_select_group(job);
+		while (num != -1 && !job->group[num]->keyspace
+				&& job_repack_salt(job, job->group[num]->cmp_config.salt))
+			num = job_select_group(job);
+		if (num == -1) {
+			work_queue_no_work(&fpga->queue);
+			return 0;
+		}
+		struct job_group *new_group = job->group[num];
+		if (!new_group->keyspace) {
+			new_group->keyspace = keyspace_new(&job->word_gen);
+			if (!new_group->keyspace)
+				return 0;
+		}
+		*cmp_config = job_group_config_pkt(job, new_group);
+		if (!*cmp_config)
+			return 0;
+		job_fpga_unconfigure(job, fpga);
+		fpga->group = num;
+		group = new_group;
+		group->num_fpgas++;
+		job_fpga_configured(fpga, group, pkt_id);
+		job->num_reconfigs++;
+	}
+
+	// Shrunken configuration is sent between chunks if duplicate
+	// results cost more than FPGA's drain
+	else if (fpga->num_cracked < group->num_cracked && fpga->num_dup_results
+			&& fpga->num_dup_results * JOB_DUP_RESULT_USEC >= job->drain_usec) {
+		*cmp_config = job_group_config_pkt(job, group);
+		if (!*cmp_config)
+			return 0;
+		job_fpga_configured(fpga, group, pkt_id);
+		job->num_shrinks++;
+	}
+
+	// Chunks get smaller near the end of group's keyspace
+	double total_rate = 0;
+	int i;
+	for (i = 0; i < job->num_fpgas; i++)
+		if (job->fpga[i]->group == fpga->group)
+			total_rate += job->fpga[i]->queue.rate;
+
+	fpga->queue.target_usec = job_chunk_usec(job);
+	if (!keyspace_fpga_next(group->keyspace, &fpga->queue, total_rate,
+			pkt_id, word_gen)) {
+		// CMP_CONFIG is sent anyway, it applies to the next chunk
+		if (*cmp_config)
+			fpga->reconfig_pkt_id = -1;
+		return 0;
+	}
+	job->pkt_group[pkt_id] = fpga->group;
+	return 1;
+}
+
+static void job_group_check_done(struct job *job, struct job_group *group)
+{
+	if (group->done)
+		return;
+	if (group->keyspace) {
+		if (!keyspace_finished(group->keyspace))
+			return;
+		keyspace_delete(group->keyspace);
+		group->keyspace = NULL;
+	}
+	// Not started yet: done if all hashes are cracked
+	else if (group->num_cracked < group->cmp_config.num_hashes)
+		return;
+	group->done = 1;
+	job->num_groups_done++;
+}
+
+// Processing of the 1st chunk after CMP_CONFIG takes longer
+// by FPGA's drain time
+static void job_fpga_measure_drain(struct job *job, struct job_fpga *fpga,
+		unsigned short pkt_id, unsigned int num_processed)
+{
+	struct work_queue *queue = &fpga->queue;
+	if (pkt_id != fpga->reconfig_pkt_id)
+		return;
+	fpga->reconfig_pkt_id = -1;
+	if (!queue->rate || !queue->last_done_usec)
+		return;
+
+	int i = work_queue_find(queue, pkt_id);
+	if (i == -1)
+		return;
+	uint64_t start = queue->unit[i].sent_usec > queue->last_done_usec
+			? queue->unit[i].sent_usec : queue->last_done_usec;
+	double drain_usec = (double)(work_queue_usec() - start)
+			- num_processed * 1e6 / queue->rate;
+	if (drain_usec < 0)
+		drain_usec = 0;
+	job->drain_usec = (3 * job->drain_usec + drain_usec) / 4;
+	fpga->num_drains++;
+	fpga->drain_usec += drain_usec;
+}
+
+int job_fpga_done(struct job *job, struct job_fpga *fpga,
+		unsigned short pkt_id, unsigned int num_processed)
+{
+	struct job_group *group = job->group[ job->pkt_group[pkt_id] ];
+	int result;
+	if (!group->keyspace)
+		return -1;
+	job_fpga_measure_drain(job, fpga, pkt_id, num_processed);
+	result = keyspace_fpga_done(group->keyspace, &fpga->queue, pkt_id,
+			num_processed);
+	if (result < 0)
+		return result;
+
+	job_group_check_done(job, group);
+	return 0;
+}
+
+int job_fpga_cancel(struct job *job, struct job_fpga *fpga,
+		unsigned short pkt_id)
+{
+	struct job_group *group = job->group[ job->pkt_group[pkt_id] ];
+	int result;
+	if (!group->keyspace)
+		return -1;
+	if (fpga->reconfig_pkt_id == pkt_id)
+		fpga->reconfig_pkt_id = -1;
+	result = keyspace_fpga_cancel(group->keyspace, &fpga->queue, pkt_id);
+	if (result < 0)
+		return result;
+
+	job_group_check_done(job, group);
+	return 0;
+}
+
+int job_fpga_abort(struct job *job, struct job_fpga *fpga)
+{
+	int i, result = 0;
+	for (i = 0; i < fpga->queue.num_units; i++) {
+		struct work_unit *unit = &fpga->queue.unit[i];
+		struct job_group *group = job->group[ job->pkt_group[unit->pkt_id] ];
+		struct keyspace_range range = { unit->start, unit->count };
+		// Nothing to return if all hashes are cracked
+		if (group->num_cracked < group->cmp_config.num_hashes
+				&& keyspace_return(group->keyspace, &range) < 0)
+			result = -1;
+		group->keyspace->inflight--;
+		job_group_check_done(job, group);
+	}
+	work_queue_clear(&fpga->queue);
+	fpga->reconfig_pkt_id = -1;
+	job_fpga_unconfigure(job, fpga);
+	return result;
+}
+
+void job_fpga_unconfigure(struct job *job, struct job_fpga *fpga)
+{
+	if (fpga->group == -1)
+		return;
+	job->group[fpga->group]->num_fpgas--;
+	fpga->group = -1;
+}
+
+struct cmp_config *job_cmp_config(struct job *job, unsigned short pkt_id)
+{
+	return &job->group[ job->pkt_group[pkt_id] ]->cmp_config;
+}
+
+int job_crack(struct job *job, struct job_fpga *fpga, int salt,
+		uint64_t hash)
+{
+	int num = job->salt_group[salt & (JOB_NUM_SALTS - 1)];
+	if (num == -1)
+		return -1;
+	for ( ; num < job->num_groups && job->group[num]->cmp_config.salt == salt;
+			num++) {
+		struct job_group *group = job->group[num];
+		int hash_num = des_bs_cmp_search(&group->cmp_config, hash);
+		if (hash_num == -1)
+			continue;
+
+		if (group->cracked[hash_num]) {
+			job->num_dup_results++;
+			if (fpga)
+				fpga->num_dup_results++;
+			return 0;
+		}
+		group->cracked[hash_num] = 1;
+		group->num_cracked++;
+		job->num_cracked++;
+
+		// The rest of the group's keyspace is skipped
+		if (group->num_cracked == group->cmp_config.num_hashes) {
+			if (group->keyspace)
+				keyspace_drop(group->keyspace);
+			job_group_check_done(job, group);
+		}
+		return 1;
+	}
+
+	// Cracked before its group was repacked
+	uint64_t *cracked = job->salt_hash[salt & (JOB_NUM_SALTS - 1)];
+	int lo = 0, hi = job->salt_count[salt & (JOB_NUM_SALTS - 1)] - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (cracked[mid] == hash) {
+			job->num_dup_results++;
+			if (fpga)
+				fpga->num_dup_results++;
+			return 0;
+		}
+		if (cracked[mid] < hash)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+struct cmp_config *job_find_salt(struct job *job, int salt)
+{
+	int num = job->salt_group[salt & (JOB_NUM_SALTS - 1)];
+	return num == -1 ? NULL : &job->group[num]->cmp_config;
+}
+
+int job_finished(struct job *job)
+{
+	return job->num_groups_done == job->num_groups;
+}
@@ -0,0 +1,164 @@
+//===============================================================
+//
+// Multi-hash job over comparator configurations.
+//
+// * Hashes (crypt(3) strings, mixed salts) are loaded from a file,
+//   bucketed by salt, sorted in ascending order (as required by
+//   the comparator), duplicates are removed.
+// * Bucket with more than CMP_CONFIG_NUM_HASHES_MAX hashes is split
+//   into several groups of about the same size. Each group is
+//   a comparator configuration (CMP_CONFIG packet).
+// * Every group gets the whole keyspace of the job's word_gen,
+//   each group has its own struct keyspace.
+// * Reconfiguration of the comparator drains all cores of the
+//   FPGA, so FPGA stays with its group until group's keyspace is
+//   handed out. Then FPGA takes the group with most remaining work
+//   per FPGA (groups no FPGA works on go first).
+// * Chunks in flight may belong to the group FPGA was configured
+//   with before. Group of each chunk is found by its pkt_id.
+// * Cracked hashes are tracked per group. Results for hashes
+//   already cracked are duplicates, they're suppressed. When all
+//   hashes of a group are cracked, the rest of its keyspace is
+//   dropped.
+// * Before a group is started, groups of its salt that aren't
+//   started yet are repacked with hashes not yet cracked (e.g. by
+//   the word list), surplus groups are done without running
+//   the keyspace.
+// * Comparator configuration sent to FPGA has only hashes not yet
+//   cracked. FPGA that receives duplicate results gets shrunken
+//   configuration before its next chunk, if results cost more than
+//   the reconfiguration (drain time of the FPGA, measured on the
+//   1st chunk after each CMP_CONFIG).
+// * CMP_CONFIG is sent only between chunks, so a chunk is the least
+//   work between reconfigurations. Chunks take at least
+//   JOB_SWITCH_RATIO drain times (switch overhead is under 1%).
+// * Salt with more than CMP_CONFIG_NUM_HASHES_MAX hashes still takes
+//   a pass over the keyspace per group. Repacking only saves groups
+//   emptied by cracks. A one-pass mode (comparator holds a filter of
+//   partial hash bits, hits are confirmed with des_bs) is blocked on
+//   the bitstream: the comparator does exact 64-bit compare against
+//   block RAM of 2^(RAM_ADDR_MSB+1) entries, COMPARE_35_BIT in
+//   descrypt.vh isn't implemented.
+//
+//===============================================================
+
+#define JOB_NUM_SALTS	4096
+// Reconfiguration cost until it's measured
+#define JOB_DRAIN_USEC_INITIAL	1000
+// Cost of a duplicate result (transmission, verification on CPU)
+#define JOB_DUP_RESULT_USEC		20
+// Work between reconfigurations, in drain times
+#define JOB_SWITCH_RATIO		100
+
+struct job_group {
+	struct cmp_config cmp_config;
+	struct keyspace *keyspace;	// created when 1st FPGA takes the group
+	int num_fpgas;				// FPGAs configured with the group
+	int done;
+	unsigned char cracked[CMP_CONFIG_NUM_HASHES_MAX];
+	int num_cracked;
+};
+
+struct job_fpga {
+	int group;					// -1 if not configured
+	struct work_queue queue;
+	int num_cracked;			// group's cracked hashes when configured
+	int num_dup_results;		// duplicate results since configured
+	int reconfig_pkt_id;		// 1st chunk after CMP_CONFIG, -1 if none
+	// reconfigurations of the FPGA, measured drain time
+	int num_reconfigs, num_drains;
+	double drain_usec;
+};
+
+struct job {
+	struct word_gen word_gen;
+	struct pkt_pool *pool;		// CMP_CONFIG packets are allocated from it
+	uint64_t keyspace_count;	// candidates for each group
+	// hashes loaded, before job_start(); after that,
+	// cracked hashes removed from groups when they're repacked
+	uint64_t *salt_hash[JOB_NUM_SALTS];
+	int salt_count[JOB_NUM_SALTS];
+	int salt_size[JOB_NUM_SALTS];
+
+	int num_groups;
+	struct job_group **group;
+	int num_groups_done;
+	int pkt_group[65536];		// group of WORD_GEN packet in flight
+	int salt_group[JOB_NUM_SALTS];	// 1st group with the salt, -1 if none
+	double drain_usec;
+
+	int num_fpgas;
+	struct job_fpga **fpga;
+
+	// statistics
+	uint64_t num_hashes, num_duplicates, num_bad_lines;
+	uint64_t num_cracked, num_dup_results;
+	int num_reconfigs, num_shrinks, num_merged;
+};
+
+// CMP_CONFIG packets are allocated from 'pool' (heap if NULL)
+struct job *job_new(struct word_gen *word_gen, struct pkt_pool *pool);
+
+void job_delete(struct job *job);
+
+// Adds hash from crypt(3) string. Returns -1 if string is invalid
+int job_add_hash(struct job *job, char *str);
+
+// Loads hashes from the file, one per line, "hash" or
+// "login:hash[:...]". Returns -1 on I/O error
+int job_load(struct job *job, char *path);
+
+// Sorts hashes, creates groups. Hashes can't be added after that.
+// Returns -1 if there are no hashes
+int job_start(struct job *job);
+
+// Registers FPGA
+struct job_fpga *job_fpga_new(struct job *job);
+
+// FPGA's chunks must be done or aborted
+void job_fpga_delete(struct job *job, struct job_fpga *fpga);
+
+// Takes next chunk for the FPGA (if its work queue isn't full).
+// If FPGA is reconfigured, CMP_CONFIG packet is set, it must be
+// sent before WORD_GEN.
+// Returns 0 if there's no chunk for the FPGA
+int job_fpga_next(struct job *job, struct job_fpga *fpga,
+		unsigned short pkt_id, struct word_gen *word_gen,
+		struct pkt **cmp_config);
+
+// PROCESSING_DONE received.
+// Returns -1 if the packet isn't a chunk in flight on the FPGA,
+// -2 if the rest of partially processed chunk can't be returned
+int job_fpga_done(struct job *job, struct job_fpga *fpga,
+		unsigned short pkt_id, unsigned int num_processed);
+
+// Chunk wasn't sent (e.g. worker's ring is full), it returns to
+// its group. Returns same as job_fpga_done()
+int job_fpga_cancel(struct job *job, struct job_fpga *fpga,
+		unsigned short pkt_id);
+
+// FPGA failed, its chunks return to their groups.
+// Returns -1 if some chunk can't be returned
+int job_fpga_abort(struct job *job, struct job_fpga *fpga);
+
+// FPGA was configured outside of the job
+void job_fpga_unconfigure(struct job *job, struct job_fpga *fpga);
+
+// Chunk duration, depends on the measured drain time
+uint64_t job_chunk_usec(struct job *job);
+
+// Comparator configuration for CMP_EQUAL results of the packet
+// (all hashes of the group, including cracked ones)
+struct cmp_config *job_cmp_config(struct job *job, unsigned short pkt_id);
+
+// Verified result from the FPGA ('fpga' is NULL if configured
+// outside of the job). Returns 1 if the hash is cracked, 0 if it
+// was cracked before, -1 if the job has no such hash
+int job_crack(struct job *job, struct job_fpga *fpga, int salt,
+		uint64_t hash);
+
+// 1st group with the salt, NULL if none
+struct cmp_config *job_find_salt(struct job *job, int salt);
+
+// All groups are done
+int job_finished(struct job *job);
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "pkt_comm/pkt_comm.h"
+#include "pkt_comm/word_gen.h"
+#include "work_queue.h"
+#include "keyspace.h"
+
+struct keyspace *keyspace_new(struct word_gen *word_gen)
+{
+	int i;
+	if (!word_gen->num_ranges || word_gen->num_ranges > RANGES_MAX) {
+		fprintf(stderr, "keyspace_new(): bad num_ranges %d\n", word_gen->num_ranges);
+		return NULL;
+	}
+
+	struct keyspace *ks = calloc(1, sizeof(struct keyspace));
+	if (!ks) {
+		fprintf(stderr, "keyspace_new(): unable to allocate %d bytes\n",
+				(int)sizeof(struct keyspace));
+		return NULL;
+	}
+	ks->word_gen = *word_gen;
+
+	uint64_t total = 1;
+	for (i = 0; i < word_gen->num_ranges; i++) {
+		struct word_gen_char_range *range = &word_gen->ranges[i];
+		if (!range->num_chars || range->start_idx >= range->num_chars) {
+			fprintf(stderr, "keyspace_new(): bad range %d\n", i);
+			free(ks);
+			return NULL;
+		}
+		ks->next = ks->next * range->num_chars + range->start_idx;
+		total *= range->num_chars;
+		ks->word_gen.ranges[i].start_idx = 0;
+	}
+	ks->end = total;
+	if (word_gen->num_generate && ks->next + word_gen->num_generate < ks->end)
+		ks->end = ks->next + word_gen->num_generate;
+	ks->word_gen.num_generate = 0;
+	return ks;
+}
+
+void keyspace_delete(struct keyspace *ks)
+{
+	free(ks->returned);
+	free(ks);
+}
+
+uint64_t keyspace_remaining(struct keyspace *ks)
+{
+	uint64_t count = ks->end - ks->next;
+	int i;
+	for (i = 0; i < ks->num_returned; i++)
+		count += ks->returned[i].count;
+	return count;
+}
+
+int keyspace_finished(struct keyspace *ks)
+{
+	return !ks->inflight && !keyspace_remaining(ks);
+}
+
+// Sets start_idx of ranges to the digits of 'start' (mixed-radix,
+// the last range is the least significant)
+static void keyspace_set_word_gen(struct keyspace *ks,
+		struct keyspace_range *range, struct word_gen *word_gen)
+{
+	uint64_t value = range->start;
+	int i;
+	*word_gen = ks->word_gen;
+	for (i = word_gen->num_ranges - 1; i >= 0; i--) {
+		int num_chars = word_gen->ranges[i].num_chars;
+		word_gen->ranges[i].start_idx = value % num_chars;
+		value /= num_chars;
+	}
+	word_gen->num_generate = range->count;
+}
+
+int keyspace_next(struct keyspace *ks, uint64_t count,
+		struct keyspace_range *range, struct word_gen *word_gen)
+{
+	if (count > KEYSPACE_CHUNK_MAX)
+		count = KEYSPACE_CHUNK_MAX;
+	if (!count)
+		count = 1;
+
+	// Returned chunks go first, they are split if needed
+	if (ks->num_returned) {
+		struct keyspace_range *returned = &ks->returned[ks->num_returned - 1];
+		range->start = returned->start;
+		range->count = returned->count < count ? returned->count : count;
+		returned->start += range->count;
+		returned->count -= range->count;
+		if (!returned->count)
+			ks->num_returned--;
+	}
+	else if (ks->next < ks->end) {
+		range->start = ks->next;
+		range->count = ks->end - ks->next < count ? ks->end - ks->next : count;
+		ks->next += range->count;
+	}
+	else
+		return 0;
+
+	keyspace_set_word_gen(ks, range, word_gen);
+	return 1;
+}
+
+int keyspace_return(struct keyspace *ks, struct keyspace_range *range)
+{
+	if (ks->num_returned) {
+		struct keyspace_range *last = &ks->returned[ks->num_returned - 1];
+		if (last->start + last->count == range->start) {
+			last->count += range->count;
+			return 0;
+		}
+		if (range->start + range->count == last->start) {
+			last->start = range->start;
+			last->count += range->count;
+			return 0;
+		}
+	}
+
+	if (ks->num_returned == ks->size_returned) {
+		int size = ks->size_returned ? ks->size_returned * 2 : 16;
+		struct keyspace_range *returned = realloc(ks->returned,
+				size * sizeof(struct keyspace_range));
+		if (!returned) {
+			fprintf(stderr, "keyspace_return(): unable to allocate %d bytes\n",
+					(int)(size * sizeof(struct keyspace_range)));
+			return -1;
+		}
+		ks->returned = returned;
+		ks->size_returned = size;
+	}
+	ks->returned[ks->num_returned++] = *range;
+	return 0;
+}
+
+void keyspace_drop(struct keyspace *ks)
+{
+	ks->next = ks->end;
+	ks->num_returned = 0;
+}
+
+int keyspace_fpga_next(struct keyspace *ks, struct work_queue *queue,
+		double total_rate, unsigned short pkt_id, struct word_gen *word_gen)
+{
+	if (work_queue_full(queue))
+		return 0;
+
+	uint64_t count = work_queue_count(queue, keyspace_remaining(ks), total_rate);
+	if (count < KEYSPACE_CHUNK_MIN)
+		count = KEYSPACE_CHUNK_MIN;
+
+	struct keyspace_range range;
+	if (!keyspace_next(ks, count, &range, word_gen)) {
+		work_queue_no_work(queue);
+		return 0;
+	}
+	work_queue_add(queue, pkt_id, range.start, range.count);
+	ks->inflight++;
+	return 1;
+}
+
+int keyspace_fpga_done(struct keyspace *ks, struct work_queue *queue,
+		unsigned short pkt_id, unsigned int num_processed)
+{
+	struct work_unit unit;
+	if (work_queue_done(queue, pkt_id, num_processed, &unit) < 0)
+		return -1;
+
+	ks->done_count += num_processed < unit.count ? num_processed : unit.count;
+	ks->inflight--;
+
+	// Not expected: the rest of chunk wasn't processed
+	if (num_processed < unit.count) {
+		struct keyspace_range rest = {
+			unit.start + num_processed,
+			unit.count - num_processed
+		};
+		if (keyspace_return(ks, &rest) < 0)
+			return -2;
+	}
+	return 0;
+}
+
+int keyspace_fpga_cancel(struct keyspace *ks, struct work_queue *queue,
+		unsigned short pkt_id)
+{
+	struct work_unit unit;
+	if (work_queue_cancel(queue, pkt_id, &unit) < 0)
+		return -1;
+
+	struct keyspace_range range = { unit.start, unit.count };
+	ks->inflight--;
+	if (keyspace_return(ks, &range) < 0)
+		return -2;
+	return 0;
+}
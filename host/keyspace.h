@@ -0,0 +1,80 @@
+//===============================================================
+//
+// Keyspace partitioning.
+//
+// * Candidates of word_gen ranges are numbered in the order
+//   word_gen produces them. Keyspace is split into contiguous
+//   chunks, each chunk is a word_gen with start_idx of every
+//   range and num_generate set.
+// * If word_gen inserts words, the chunk applies to each word
+//   (word list is sent after every chunk).
+// * Chunks are handed out on demand, to FPGA's work queue
+//   (see work_queue.h): chunk size is computed from the FPGA's
+//   measured rate and the rest of the keyspace.
+// * Chunks of a failed FPGA return to the keyspace.
+//
+//===============================================================
+
+// num_generate is 32-bit
+#define KEYSPACE_CHUNK_MAX		0xFFFFFFFFULL
+#define KEYSPACE_CHUNK_MIN		65536
+
+struct keyspace_range {
+	uint64_t start;
+	uint64_t count;
+};
+
+struct keyspace {
+	struct word_gen word_gen;	// template
+	uint64_t next, end;
+	// chunks returned from failed FPGAs, the array grows as needed
+	int num_returned, size_returned;
+	struct keyspace_range *returned;
+	int inflight;				// chunks in flight on all FPGAs
+	uint64_t done_count;		// candidates processed
+};
+
+// Keyspace starts from start_idx of template's ranges,
+// is limited with num_generate (if not 0)
+struct keyspace *keyspace_new(struct word_gen *word_gen);
+
+void keyspace_delete(struct keyspace *ks);
+
+// Candidates not yet handed out
+uint64_t keyspace_remaining(struct keyspace *ks);
+
+// All chunks are processed
+int keyspace_finished(struct keyspace *ks);
+
+// Takes next chunk of up to 'count' candidates, sets word_gen for it.
+// Returns 0 if there are no more chunks
+int keyspace_next(struct keyspace *ks, uint64_t count,
+		struct keyspace_range *range, struct word_gen *word_gen);
+
+// Returns a chunk that wasn't processed. It's merged with the chunk
+// returned before if they're adjacent.
+// Returns -1 if unable to allocate memory
+int keyspace_return(struct keyspace *ks, struct keyspace_range *range);
+
+// Remaining candidates (including returned chunks) aren't handed out,
+// keyspace finishes when chunks in flight are done
+void keyspace_drop(struct keyspace *ks);
+
+// Takes next chunk for the FPGA if its work queue isn't full.
+// 'total_rate' is the sum of rates of FPGAs in use.
+// Chunk is sent with WORD_GEN packet 'pkt_id'.
+// Returns 0 if there's no chunk for the FPGA
+int keyspace_fpga_next(struct keyspace *ks, struct work_queue *queue,
+		double total_rate, unsigned short pkt_id, struct word_gen *word_gen);
+
+// PROCESSING_DONE received. Updates FPGA's rate.
+// Returns -1 if the packet isn't a chunk in FPGA's queue,
+// -2 if the rest of partially processed chunk can't be returned
+int keyspace_fpga_done(struct keyspace *ks, struct work_queue *queue,
+		unsigned short pkt_id, unsigned int num_processed);
+
+// Chunk wasn't sent, it returns to the keyspace.
+// Returns -1 if the packet isn't a chunk in FPGA's queue,
+// -2 if the chunk can't be returned
+int keyspace_fpga_cancel(struct keyspace *ks, struct work_queue *queue,
+		unsigned short pkt_id);
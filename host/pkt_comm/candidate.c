@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pkt_comm.h"
+#include "word_gen.h"
+#include "candidate.h"
+
+
+struct candidate_map *candidate_map_new()
+{
+	struct candidate_map *map = calloc(1, sizeof(struct candidate_map));
+	if (!map) {
+		pkt_error("candidate_map_new(): unable to allocate %d bytes\n",
+				sizeof(struct candidate_map));
+		return NULL;
+	}
+	return map;
+}
+
+static void candidate_pkt_delete(struct candidate_pkt *pkt)
+{
+	free(pkt->words);
+	free(pkt->word_len);
+	free(pkt);
+}
+
+void candidate_map_delete(struct candidate_map *map)
+{
+	int i;
+	for (i = 0; i < CANDIDATE_PKT_ID_MAX; i++)
+		if (map->pkt[i])
+			candidate_pkt_delete(map->pkt[i]);
+	free(map);
+}
+
+// Words are split same way as in word_list.v: empty words are skipped,
+// chars beyond WORD_MAX_LEN are skipped, CHAR_BITS are used
+static int candidate_pkt_set_words(struct candidate_pkt *pkt, char **words)
+{
+	int count = 0;
+	int i, j;
+	for (i = 0; words[i]; i++)
+		if (words[i][0])
+			count++;
+	if (!count || count > 65536) {
+		pkt_error("candidate_map_add(): bad number of words %d\n", count);
+		return -1;
+	}
+
+	pkt->words = calloc(count, WORD_MAX_LEN);
+	pkt->word_len = malloc(count);
+	if (!pkt->words || !pkt->word_len) {
+		pkt_error("candidate_map_add(): unable to allocate memory for %d words\n",
+				count);
+		return -1;
+	}
+
+	pkt->num_words = 0;
+	for (i = 0; words[i]; i++) {
+		if (!words[i][0])
+			continue;
+		unsigned char *word = pkt->words + pkt->num_words * WORD_MAX_LEN;
+		for (j = 0; j < WORD_MAX_LEN && words[i][j]; j++)
+			word[j] = words[i][j] & ((1 << CHAR_BITS) - 1);
+		pkt->word_len[pkt->num_words++] = j;
+	}
+	return 0;
+}
+
+// Same as word_list.v: words are separated with 0's
+static int candidate_pkt_set_words_pkt(struct candidate_pkt *pkt,
+		struct pkt *word_list)
+{
+	unsigned char *data = word_list->data;
+	int count = 0;
+	int i, j;
+	for (i = 0; i < word_list->data_len; i++)
+		if (data[i] && (i + 1 == word_list->data_len || !data[i + 1]))
+			count++;
+	if (!count || count > 65536) {
+		pkt_error("candidate_map_add_pkt(): bad number of words %d\n", count);
+		return -1;
+	}
+
+	pkt->words = calloc(count, WORD_MAX_LEN);
+	pkt->word_len = malloc(count);
+	if (!pkt->words || !pkt->word_len) {
+		pkt_error("candidate_map_add_pkt(): unable to allocate memory for %d words\n",
+				count);
+		return -1;
+	}
+
+	pkt->num_words = 0;
+	for (i = 0; i < word_list->data_len; ) {
+		if (!data[i]) {
+			i++;
+			continue;
+		}
+		unsigned char *word = pkt->words + pkt->num_words * WORD_MAX_LEN;
+		for (j = 0; i < word_list->data_len && data[i]; i++, j++)
+			if (j < WORD_MAX_LEN)
+				word[j] = data[i] & ((1 << CHAR_BITS) - 1);
+		pkt->word_len[pkt->num_words++] = j < WORD_MAX_LEN ? j : WORD_MAX_LEN;
+	}
+	return 0;
+}
+
+// Checks configuration, computes range of candidates
+static struct candidate_pkt *candidate_pkt_new(struct candidate_map *map,
+		unsigned short pkt_id, struct word_gen *word_gen, int has_words)
+{
+	int i;
+
+	if (map->pkt[pkt_id]) {
+		pkt_error("candidate_map_add(): pkt_id 0x%04x is in use\n", pkt_id);
+		return NULL;
+	}
+	if (word_gen->num_ranges > RANGES_MAX
+			|| word_gen->num_words > WORDS_INSERT_MAX
+			|| (word_gen->num_words && !has_words)
+			|| (!word_gen->num_words && has_words)
+			|| (word_gen->num_words && word_gen->word_insert_pos[0] >= WORD_MAX_LEN)) {
+		pkt_error("candidate_map_add(): bad word_gen configuration\n");
+		return NULL;
+	}
+
+	struct candidate_pkt *pkt = calloc(1, sizeof(struct candidate_pkt));
+	if (!pkt) {
+		pkt_error("candidate_map_add(): unable to allocate %d bytes\n",
+				sizeof(struct candidate_pkt));
+		return NULL;
+	}
+	pkt->word_gen = *word_gen;
+
+	// Iteration starts from start_idx of each range,
+	// ends after all ranges reach their last chars
+	unsigned long long total = 1;
+	for (i = 0; i < word_gen->num_ranges; i++) {
+		struct word_gen_char_range *range = &word_gen->ranges[i];
+		if (!range->num_chars || range->start_idx >= range->num_chars) {
+			pkt_error("candidate_map_add(): bad range %d\n", i);
+			candidate_pkt_delete(pkt);
+			return NULL;
+		}
+		pkt->start = pkt->start * range->num_chars + range->start_idx;
+		total *= range->num_chars;
+	}
+	pkt->count = total - pkt->start;
+	if (word_gen->num_generate && word_gen->num_generate < pkt->count)
+		pkt->count = word_gen->num_generate;
+	pkt->num_words = 1;
+	return pkt;
+}
+
+int candidate_map_add(struct candidate_map *map, unsigned short pkt_id,
+		struct word_gen *word_gen, char **words)
+{
+	struct candidate_pkt *pkt = candidate_pkt_new(map, pkt_id, word_gen, !!words);
+	if (!pkt)
+		return -1;
+
+	if (words && candidate_pkt_set_words(pkt, words) < 0) {
+		candidate_pkt_delete(pkt);
+		return -1;
+	}
+
+	map->pkt[pkt_id] = pkt;
+	map->count++;
+	return 0;
+}
+
+int candidate_map_add_pkt(struct candidate_map *map, unsigned short pkt_id,
+		struct word_gen *word_gen, struct pkt *word_list)
+{
+	struct candidate_pkt *pkt = candidate_pkt_new(map, pkt_id, word_gen, !!word_list);
+	if (!pkt)
+		return -1;
+
+	if (word_list && candidate_pkt_set_words_pkt(pkt, word_list) < 0) {
+		candidate_pkt_delete(pkt);
+		return -1;
+	}
+
+	map->pkt[pkt_id] = pkt;
+	map->count++;
+	return 0;
+}
+
+void candidate_map_remove(struct candidate_map *map, unsigned short pkt_id)
+{
+	if (!map->pkt[pkt_id])
+		return;
+	candidate_pkt_delete(map->pkt[pkt_id]);
+	map->pkt[pkt_id] = NULL;
+	map->count--;
+}
+
+int candidate_get(struct candidate_map *map, unsigned short pkt_id,
+		unsigned short word_id, unsigned int gen_id, unsigned char *key)
+{
+	struct candidate_pkt *pkt = map->pkt[pkt_id];
+	if (!pkt || word_id >= pkt->num_words || gen_id >= pkt->count)
+		return -1;
+
+	struct word_gen *word_gen = &pkt->word_gen;
+	unsigned char idx[RANGES_MAX];
+	// The last range changes fastest
+	unsigned long long value = pkt->start + gen_id;
+	int i;
+	for (i = word_gen->num_ranges - 1; i >= 0; i--) {
+		int num_chars = word_gen->ranges[i].num_chars;
+		idx[i] = value % num_chars;
+		value /= num_chars;
+	}
+
+	// Word is inserted at word_insert_pos, ranges go before and after it
+	int insert_pos = word_gen->num_words ? word_gen->word_insert_pos[0] : WORD_MAX_LEN;
+	int len = word_gen->num_words ? pkt->word_len[word_id] : 0;
+	unsigned char *word = pkt->words + word_id * WORD_MAX_LEN;
+	for (i = 0; i < WORD_MAX_LEN; i++) {
+		int range_num = i < insert_pos ? i : i - len;
+		if (i >= insert_pos && i < insert_pos + len)
+			key[i] = word[i - insert_pos];
+		else if (range_num < word_gen->num_ranges)
+			key[i] = word_gen->ranges[range_num].chars[ idx[range_num] ];
+		else
+			key[i] = 0;
+	}
+	return 0;
+}
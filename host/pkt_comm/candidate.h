@@ -0,0 +1,56 @@
+
+// ***************************************************************
+//
+// Candidate reconstruction
+//
+// CMP_EQUAL output packet refers to the candidate with
+// pkt_id (ID of WORD_GEN packet), word_id (number of the word
+// in the word list, 0 if no words are inserted) and gen_id
+// (number of the candidate generated for the word).
+//
+// Host keeps configuration of each WORD_GEN packet in flight
+// (with its word list), candidate is computed directly
+// from the IDs, same way as word_gen.v produces it.
+//
+// ***************************************************************
+
+#define CANDIDATE_PKT_ID_MAX	65536
+
+struct candidate_pkt {
+	struct word_gen word_gen;
+	unsigned long long start;	// ranges start at that mixed-radix value
+	unsigned long long count;	// candidates per word
+	int num_words;
+	unsigned char *words;		// WORD_MAX_LEN bytes per word, 0-padded
+	unsigned char *word_len;
+};
+
+struct candidate_map {
+	int count;
+	struct candidate_pkt *pkt[CANDIDATE_PKT_ID_MAX];
+};
+
+struct candidate_map *candidate_map_new();
+
+void candidate_map_delete(struct candidate_map *map);
+
+// Registers WORD_GEN packet with ID 'pkt_id' and its word list
+// (NULL-terminated, same as for pkt_word_list_new()).
+// 'words' must be NULL if word_gen doesn't insert words.
+// Returns -1 if configuration is invalid or ID is in use
+int candidate_map_add(struct candidate_map *map, unsigned short pkt_id,
+		struct word_gen *word_gen, char **words);
+
+// Same as candidate_map_add(), words are taken from WORD_LIST packet
+// (NULL if word_gen doesn't insert words)
+int candidate_map_add_pkt(struct candidate_map *map, unsigned short pkt_id,
+		struct word_gen *word_gen, struct pkt *word_list);
+
+// Removes packet after all its results are processed
+// (PROCESSING_DONE was received)
+void candidate_map_remove(struct candidate_map *map, unsigned short pkt_id);
+
+// Rebuilds candidate into 'key' (WORD_MAX_LEN bytes, 0-padded).
+// Returns -1 if pkt_id is unknown or word_id, gen_id are out of range
+int candidate_get(struct candidate_map *map, unsigned short pkt_id,
+		unsigned short word_id, unsigned int gen_id, unsigned char *key);
@@ -8,10 +8,10 @@
 #include "cmp_config.h"
 
 
-struct pkt *pkt_cmp_config_new(struct cmp_config *cmp_config)
+struct pkt *pkt_cmp_config_new_pool(struct pkt_pool *pool, struct cmp_config *cmp_config)
 {
 
-	char *data = malloc(CMP_CONFIG_MAX_SIZE);
+	char *data = pkt_pool_alloc(pool, CMP_CONFIG_MAX_SIZE);
 	if (!data) {
 		pkt_error("pkt_cmp_config_new(): unable to allocate %d bytes\n",
 				CMP_CONFIG_MAX_SIZE);
@@ -24,6 +24,10 @@ struct pkt *pkt_cmp_config_new(struct cmp_config *cmp_config)
 
 	if (cmp_config->salt & 0xf000) {
 		pkt_error("pkt_cmp_config_new(): bad salt 0x%04x\n", cmp_config->salt);
+		if (pool)
+			pkt_pool_free(data);
+		else
+			free(data);
 		return NULL;
 	}
 	data[offset++] = cmp_config->salt;
@@ -31,6 +35,10 @@ struct pkt *pkt_cmp_config_new(struct cmp_config *cmp_config)
 
 	if (!cmp_config->num_hashes || cmp_config->num_hashes > CMP_CONFIG_NUM_HASHES_MAX) {
 		pkt_error("pkt_cmp_config_new(): bad num_hashes %d\n", cmp_config->num_hashes);
+		if (pool)
+			pkt_pool_free(data);
+		else
+			free(data);
 		return NULL;
 	}
 	data[offset++] = cmp_config->num_hashes;
@@ -44,9 +52,14 @@ struct pkt *pkt_cmp_config_new(struct cmp_config *cmp_config)
 	
 	data[offset++] = 0xCC;
 	
-	struct pkt *pkt = pkt_new(PKT_TYPE_CMP_CONFIG, data, offset);
+	struct pkt *pkt = pkt_new_pool(pool, PKT_TYPE_CMP_CONFIG, data, offset);
 	//for (i=0; i < offset; i++)
 	//	printf("0x%02x ", data[i] & 0xff);
 	//printf("\nlen: %d\n", offset);
 	return pkt;
 }
+
+struct pkt *pkt_cmp_config_new(struct cmp_config *cmp_config)
+{
+	return pkt_cmp_config_new_pool(NULL, cmp_config);
+}
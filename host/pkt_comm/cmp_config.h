@@ -27,3 +27,6 @@ struct cmp_config {
 
 struct pkt *pkt_cmp_config_new(struct cmp_config *cmp_config);
 
+// Packet and its data are allocated from the pool
+struct pkt *pkt_cmp_config_new_pool(struct pkt_pool *pool, struct cmp_config *cmp_config);
+
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pkt_comm.h"
+#include "word_gen.h"
+#include "mask.h"
+
+
+static char *mask_charset_builtin(char c)
+{
+	switch (c) {
+	case 'l': return "abcdefghijklmnopqrstuvwxyz";
+	case 'u': return "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	case 'd': return "0123456789";
+	case 's': return " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+	case 'a': return "abcdefghijklmnopqrstuvwxyz"
+			"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"0123456789"
+			" !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+	case 'h': return "0123456789abcdef";
+	case 'H': return "0123456789ABCDEF";
+	}
+	return NULL;
+}
+
+// Chars are added in order, duplicates are skipped
+static int mask_pos_add_char(struct mask_pos *pos, unsigned char c)
+{
+	int i;
+	if (c >> CHAR_BITS) {
+		pkt_error("mask: char 0x%02x exceeds CHAR_BITS=%d\n", c, CHAR_BITS);
+		return -1;
+	}
+	for (i = 0; i < pos->num_chars; i++)
+		if (pos->chars[i] == c)
+			return 0;
+	pos->chars[pos->num_chars++] = c;
+	return 0;
+}
+
+static int mask_pos_add_chars(struct mask_pos *pos, char *chars)
+{
+	for ( ; *chars; chars++)
+		if (mask_pos_add_char(pos, *chars) < 0)
+			return -1;
+	return 0;
+}
+
+// Custom charset: literal chars and built-in charsets
+static int mask_pos_add_custom(struct mask_pos *pos, char *custom)
+{
+	for ( ; *custom; custom++) {
+		if (*custom != '?') {
+			if (mask_pos_add_char(pos, *custom) < 0)
+				return -1;
+			continue;
+		}
+		custom++;
+		char *builtin = mask_charset_builtin(*custom);
+		if (*custom == '?') {
+			if (mask_pos_add_char(pos, '?') < 0)
+				return -1;
+		}
+		else if (builtin) {
+			if (mask_pos_add_chars(pos, builtin) < 0)
+				return -1;
+		}
+		else {
+			pkt_error("mask: bad custom charset \"%s\"\n", custom - 1);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+struct mask *mask_new(char *str, char **custom)
+{
+	struct mask *mask = calloc(1, sizeof(struct mask));
+	if (!mask) {
+		pkt_error("mask_new(): unable to allocate %d bytes\n",
+				sizeof(struct mask));
+		return NULL;
+	}
+	mask->insert_pos = -1;
+
+	char *p;
+	for (p = str; *p; p++) {
+		if (*p == '?' && p[1] == 'w') {
+			if (mask->insert_pos != -1) {
+				pkt_error("mask \"%s\": max. %d word insertion(s)\n",
+						str, WORDS_INSERT_MAX);
+				goto error;
+			}
+			mask->insert_pos = mask->num_pos;
+			p++;
+			continue;
+		}
+
+		if (mask->num_pos == RANGES_MAX) {
+			pkt_error("mask \"%s\": max. %d positions\n", str, RANGES_MAX);
+			goto error;
+		}
+		struct mask_pos *pos = &mask->pos[mask->num_pos++];
+		if (*p != '?') {
+			if (mask_pos_add_char(pos, *p) < 0)
+				goto error;
+			continue;
+		}
+
+		p++;
+		char *builtin = mask_charset_builtin(*p);
+		if (*p == '?') {
+			if (mask_pos_add_char(pos, '?') < 0)
+				goto error;
+		}
+		else if (builtin) {
+			if (mask_pos_add_chars(pos, builtin) < 0)
+				goto error;
+		}
+		else if (*p >= '1' && *p < '1' + MASK_CUSTOM_MAX) {
+			if (!custom || !custom[*p - '1'] || !custom[*p - '1'][0]) {
+				pkt_error("mask \"%s\": custom charset ?%c is not defined\n",
+						str, *p);
+				goto error;
+			}
+			if (mask_pos_add_custom(pos, custom[*p - '1']) < 0)
+				goto error;
+		}
+		else {
+			pkt_error("mask \"%s\": bad charset ?%c\n", str, *p ? *p : ' ');
+			goto error;
+		}
+	}
+
+	if (!mask->num_pos && mask->insert_pos == -1) {
+		pkt_error("mask_new(): empty mask\n");
+		goto error;
+	}
+	// word_insert_pos in WORD_GEN is 3-bit
+	if (mask->insert_pos >= WORD_MAX_LEN) {
+		pkt_error("mask \"%s\": ?w at position %d, max. %d\n",
+				str, mask->insert_pos, WORD_MAX_LEN - 1);
+		goto error;
+	}
+
+	int i;
+	for (i = 0; i < mask->num_pos; i++) {
+		struct mask_pos *pos = &mask->pos[i];
+		pos->num_parts = (pos->num_chars + MASK_RANGE_CHARS_MAX - 1)
+				/ MASK_RANGE_CHARS_MAX;
+	}
+	mask_rewind(mask);
+	return mask;
+
+error:
+	free(mask);
+	return NULL;
+}
+
+void mask_delete(struct mask *mask)
+{
+	free(mask);
+}
+
+unsigned long long mask_count(struct mask *mask)
+{
+	unsigned long long count = 1;
+	int i;
+	for (i = 0; i < mask->num_pos; i++)
+		count *= mask->pos[i].num_chars;
+	return count;
+}
+
+static int mask_part_size(struct mask *mask, int pos_num)
+{
+	struct mask_pos *pos = &mask->pos[pos_num];
+	int start = mask->part[pos_num] * MASK_RANGE_CHARS_MAX;
+	return pos->num_chars - start < MASK_RANGE_CHARS_MAX
+			? pos->num_chars - start : MASK_RANGE_CHARS_MAX;
+}
+
+static void mask_set_count(struct mask *mask)
+{
+	int i;
+	mask->count = 1;
+	for (i = 0; i < mask->num_pos; i++)
+		mask->count *= mask_part_size(mask, i);
+	mask->next = 0;
+}
+
+void mask_rewind(struct mask *mask)
+{
+	memset(mask->part, 0, sizeof(mask->part));
+	mask->done = 0;
+	mask_set_count(mask);
+}
+
+int mask_next(struct mask *mask, struct word_gen *word_gen)
+{
+	int i;
+	if (mask->done)
+		return 0;
+
+	memset(word_gen, 0, sizeof(struct word_gen));
+	word_gen->num_ranges = mask->num_pos;
+	for (i = 0; i < mask->num_pos; i++) {
+		struct word_gen_char_range *range = &word_gen->ranges[i];
+		range->num_chars = mask_part_size(mask, i);
+		memcpy(range->chars, mask->pos[i].chars
+				+ mask->part[i] * MASK_RANGE_CHARS_MAX, range->num_chars);
+	}
+	if (mask->insert_pos != -1) {
+		word_gen->num_words = 1;
+		word_gen->word_insert_pos[0] = mask->insert_pos;
+	}
+
+	// The last range changes fastest
+	unsigned long long count = mask->count - mask->next;
+	if (count > MASK_NUM_GENERATE_MAX)
+		count = MASK_NUM_GENERATE_MAX;
+	unsigned long long value = mask->next;
+	for (i = mask->num_pos - 1; i >= 0; i--) {
+		struct word_gen_char_range *range = &word_gen->ranges[i];
+		range->start_idx = value % range->num_chars;
+		value /= range->num_chars;
+	}
+	// Configuration fits into one packet: no limit
+	word_gen->num_generate = count == mask->count ? 0 : count;
+
+	mask->next += count;
+	if (mask->next < mask->count)
+		return 1;
+
+	// Next combination of charset parts
+	for (i = mask->num_pos - 1; i >= 0; i--) {
+		if (++mask->part[i] < mask->pos[i].num_parts)
+			break;
+		mask->part[i] = 0;
+	}
+	if (i < 0)
+		mask->done = 1;
+	else
+		mask_set_count(mask);
+	return 1;
+}
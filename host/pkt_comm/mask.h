@@ -0,0 +1,60 @@
+
+// ***************************************************************
+//
+// Mask compiler
+//
+// Mask is compiled into WORD_GEN configurations.
+// Syntax (hashcat/JtR style):
+// ?l ?u ?d ?s ?a ?h ?H - built-in charsets
+// ?1 .. ?4 - custom charsets (may contain built-in charsets)
+// ?w - word insertion point (words come from WORD_LIST),
+//      before position WORD_MAX_LEN (word_insert_pos is 3-bit)
+// ?? - '?'
+// other chars are literal.
+//
+// * Each char position is a range, up to RANGES_MAX positions.
+// * If a charset doesn't fit into a range (MASK_RANGE_CHARS_MAX),
+//   it's split into parts, each combination of parts is
+//   a separate configuration.
+// * If a configuration generates more than MASK_NUM_GENERATE_MAX
+//   candidates, it's split into several packets with start_idx
+//   and num_generate.
+//
+// ***************************************************************
+
+#define MASK_CUSTOM_MAX			4
+#define MASK_RANGE_CHARS_MAX	(CHAR_BITS==7 ? 96 : 224)
+#define MASK_NUM_GENERATE_MAX	0xFFFFFFFFULL
+
+struct mask_pos {
+	int num_chars;
+	unsigned char chars[1 << CHAR_BITS];
+	int num_parts;
+};
+
+struct mask {
+	int num_pos;
+	struct mask_pos pos[RANGES_MAX];
+	int insert_pos;			// -1 if no word is inserted
+	// iteration
+	int part[RANGES_MAX];	// current part of each position
+	unsigned long long count;	// candidates in current configuration
+	unsigned long long next;
+	int done;
+};
+
+// 'custom' are charsets for ?1 .. ?4, may be NULL.
+// Returns NULL if mask is invalid
+struct mask *mask_new(char *mask, char **custom);
+
+void mask_delete(struct mask *mask);
+
+// Candidates for each word (total of all configurations)
+unsigned long long mask_count(struct mask *mask);
+
+// Sets next WORD_GEN configuration.
+// Returns 0 if there are no more configurations
+int mask_next(struct mask *mask, struct word_gen *word_gen);
+
+// Restarts iteration from the 1st configuration
+void mask_rewind(struct mask *mask);
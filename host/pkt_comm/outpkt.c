@@ -7,4 +7,106 @@
 #include "outpkt.h"
 
 
+struct outpkt_results *outpkt_results_new(int max_count)
+{
+	if (max_count <= 0) {
+		pkt_error("outpkt_results_new(): bad max_count %d\n", max_count);
+		return NULL;
+	}
 
+	struct outpkt_results *results = malloc(sizeof(struct outpkt_results));
+	if (!results) {
+		pkt_error("outpkt_results_new(): unable to allocate %d bytes\n",
+				sizeof(struct outpkt_results));
+		return NULL;
+	}
+	results->max_count = max_count;
+	results->cmp_equal = malloc(max_count * sizeof(struct outpkt_cmp_equal));
+	results->done = malloc(max_count * sizeof(struct outpkt_done));
+	if (!results->cmp_equal || !results->done) {
+		pkt_error("outpkt_results_new(): unable to allocate arrays for %d results\n",
+				max_count);
+		free(results->cmp_equal);
+		free(results->done);
+		free(results);
+		return NULL;
+	}
+	outpkt_results_clear(results);
+	return results;
+}
+
+void outpkt_results_delete(struct outpkt_results *results)
+{
+	free(results->cmp_equal);
+	free(results->done);
+	free(results);
+}
+
+void outpkt_results_clear(struct outpkt_results *results)
+{
+	results->cmp_equal_count = 0;
+	results->done_count = 0;
+	results->other_count = 0;
+	results->error_count = 0;
+}
+
+static inline unsigned short outpkt_read16(unsigned char *data)
+{
+	return data[0] | data[1] << 8;
+}
+
+static inline unsigned int outpkt_read32(unsigned char *data)
+{
+	return outpkt_read16(data) | (unsigned int)outpkt_read16(data + 2) << 16;
+}
+
+int outpkt_decode(struct pkt *pkt, struct outpkt_results *results)
+{
+	unsigned char *data = pkt->data;
+
+	if (pkt->type == PKT_TYPE_CMP_EQUAL) {
+		if (pkt->data_len != OUTPKT_CMP_EQUAL_LEN)
+			results->error_count++;
+		else if (results->cmp_equal_count == results->max_count)
+			return 0;
+		else {
+			struct outpkt_cmp_equal *cmp_equal
+					= &results->cmp_equal[results->cmp_equal_count++];
+			cmp_equal->pkt_id = outpkt_read16(data);
+			cmp_equal->word_id = outpkt_read16(data + 2);
+			cmp_equal->gen_id = outpkt_read32(data + 4);
+			cmp_equal->hash_num_eq = outpkt_read16(data + 8);
+		}
+	}
+	else if (pkt->type == PKT_TYPE_PROCESSING_DONE) {
+		if (pkt->data_len != OUTPKT_DONE_LEN)
+			results->error_count++;
+		else if (results->done_count == results->max_count)
+			return 0;
+		else {
+			struct outpkt_done *done = &results->done[results->done_count++];
+			done->pkt_id = outpkt_read16(data);
+			done->num_processed = outpkt_read32(data + 2);
+		}
+	}
+	else
+		results->other_count++;
+
+	return 1;
+}
+
+int outpkt_decode_queue(struct pkt_queue *queue, struct outpkt_results *results)
+{
+	int count = 0;
+	struct pkt *pkt;
+
+	while ( (pkt = pkt_queue_peek(queue)) ) {
+		if (!outpkt_decode(pkt, results))
+			break;
+		pkt_queue_fetch(queue);
+		pkt_delete(pkt);
+		count++;
+	}
+
+	return count;
+}
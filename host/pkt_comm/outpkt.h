@@ -9,15 +9,53 @@
 //
 // ***************************************************************
 
+#define OUTPKT_CMP_EQUAL_LEN	10
+#define OUTPKT_DONE_LEN			6
+
 struct outpkt_cmp_equal {
-	int pkt_id;
-	int word_id;
-	unsigned long gen_id;
-	int hash_num_eq;
+	unsigned short pkt_id;	// ID of PKT_TYPE_WORD_GEN packet
+	unsigned short word_id;
+	unsigned int gen_id;
+	unsigned short hash_num_eq;
 };
 
 struct outpkt_done {
-	int pkt_id;
-	unsigned long num_processed;
+	unsigned short pkt_id;
+	unsigned int num_processed;
+};
+
+// ***************************************************************
+//
+// Batched decoding of output packets
+//
+// Results are stored in packed arrays, no per-packet allocation.
+//
+// ***************************************************************
+
+struct outpkt_results {
+	int max_count;			// size of each array
+	int cmp_equal_count;
+	struct outpkt_cmp_equal *cmp_equal;
+	int done_count;
+	struct outpkt_done *done;
+	int other_count;		// packets of unknown type
+	int error_count;		// packets with wrong length
 };
 
+struct outpkt_results *outpkt_results_new(int max_count);
+
+void outpkt_results_delete(struct outpkt_results *results);
+
+// Reset counts before next decoding
+void outpkt_results_clear(struct outpkt_results *results);
+
+// Appends decoded result to the arrays. Packet isn't deleted.
+// Returns 0 if the array is full (packet isn't decoded)
+int outpkt_decode(struct pkt *pkt, struct outpkt_results *results);
+
+// Fetches packets from the queue, appends decoded results to the arrays,
+// deletes packets. Stops when the queue is empty or an array is full
+// (remaining packets stay in the queue).
+// Returns number of packets fetched
+int outpkt_decode_queue(struct pkt_queue *queue, struct outpkt_results *results);
+
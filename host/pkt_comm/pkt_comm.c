@@ -23,7 +23,225 @@ int get_pkt_count(void)
 	return total_pkt_count;
 }
 
-struct pkt *pkt_new(int type, char *data, int data_len)
+// ****************************************************************
+
+struct pkt_pool_block {
+	struct pkt_pool_class *class; // NULL if allocated from the heap
+	struct pkt_pool_block *next;
+};
+
+// Address identifies the thread
+static __thread char pkt_pool_thread;
+
+struct pkt_pool *pkt_pool_new()
+{
+	const int class_size[PKT_POOL_NUM_CLASSES] = PKT_POOL_CLASS_SIZES;
+
+	struct pkt_pool *pool = malloc(sizeof(struct pkt_pool));
+	if (!pool) {
+		pkt_error("pkt_pool_new(): unable to allocate %d bytes\n",
+				sizeof(struct pkt_pool));
+		return NULL;
+	}
+
+	int i;
+	for (i = 0; i < PKT_POOL_NUM_CLASSES; i++) {
+		pool->class[i].pool = pool;
+		pool->class[i].size = class_size[i];
+		pool->class[i].free_list = NULL;
+	}
+	pool->slab = NULL;
+	memset(&pool->stats, 0, sizeof(struct pkt_pool_stats));
+	pool->owner = &pkt_pool_thread;
+	pool->remote_free = NULL;
+	return pool;
+}
+
+// Blocks freed by other threads return to free lists of their classes
+static void pkt_pool_reclaim(struct pkt_pool *pool)
+{
+	struct pkt_pool_block *block = __atomic_exchange_n(&pool->remote_free,
+			NULL, __ATOMIC_ACQUIRE);
+	while (block) {
+		struct pkt_pool_block *next = block->next;
+		block->next = block->class->free_list;
+		block->class->free_list = block;
+		pool->stats.in_use--;
+		block = next;
+	}
+}
+
+void pkt_pool_delete(struct pkt_pool *pool)
+{
+	if (!pool)
+		return;
+	pkt_pool_reclaim(pool);
+	if (pool->stats.in_use)
+		pkt_error("pkt_pool_delete(): %d blocks in use\n", pool->stats.in_use);
+
+	while (pool->slab) {
+		void *next = *(void **)pool->slab;
+		free(pool->slab);
+		pool->slab = next;
+	}
+	free(pool);
+}
+
+// Allocate a slab, split it into blocks for the class
+int pkt_pool_class_grow(struct pkt_pool_class *class)
+{
+	// slab starts with a pointer to the next slab, blocks follow
+	int slab_header_size = sizeof(struct pkt_pool_block);
+	int block_size = sizeof(struct pkt_pool_block) + class->size;
+	int slab_size = slab_header_size + block_size > PKT_POOL_SLAB_SIZE
+			? slab_header_size + block_size : PKT_POOL_SLAB_SIZE;
+
+	void *slab = malloc(slab_size);
+	if (!slab) {
+		pkt_error("pkt_pool_class_grow(): unable to allocate %d bytes\n",
+				slab_size);
+		return -1;
+	}
+	*(void **)slab = class->pool->slab;
+	class->pool->slab = slab;
+	class->pool->stats.slab_count++;
+	class->pool->stats.heap_count++;
+
+	int offset;
+	for (offset = slab_header_size; offset + block_size <= slab_size;
+			offset += block_size) {
+		struct pkt_pool_block *block = (struct pkt_pool_block *)((char *)slab + offset);
+		block->class = class;
+		block->next = class->free_list;
+		class->free_list = block;
+	}
+	return 0;
+}
+
+void *pkt_pool_alloc(struct pkt_pool *pool, int size)
+{
+	if (!pool)
+		return malloc(size);
+
+	struct pkt_pool_block *block;
+	int i;
+	if (__atomic_load_n(&pool->owner, __ATOMIC_ACQUIRE) != &pkt_pool_thread)
+		__atomic_store_n(&pool->owner, &pkt_pool_thread, __ATOMIC_RELEASE);
+	for (i = 0; i < PKT_POOL_NUM_CLASSES; i++) {
+		struct pkt_pool_class *class = &pool->class[i];
+		if (size > class->size)
+			continue;
+
+		if (!class->free_list)
+			pkt_pool_reclaim(pool);
+		if (!class->free_list && pkt_pool_class_grow(class) < 0)
+			return NULL;
+		block = class->free_list;
+		class->free_list = block->next;
+		pool->stats.alloc_count++;
+		pool->stats.in_use++;
+		return block + 1;
+	}
+
+	// Exceeds the largest class
+	block = malloc(sizeof(struct pkt_pool_block) + size);
+	if (!block)
+		return NULL;
+	block->class = NULL;
+	pool->stats.heap_count++;
+	return block + 1;
+}
+
+void pkt_pool_free(void *ptr)
+{
+	struct pkt_pool_block *block = (struct pkt_pool_block *)ptr - 1;
+	struct pkt_pool_class *class = block->class;
+	if (!class) {
+		free(block);
+		return;
+	}
+
+	struct pkt_pool *pool = class->pool;
+	if (__atomic_load_n(&pool->owner, __ATOMIC_ACQUIRE) != &pkt_pool_thread) {
+		block->next = __atomic_load_n(&pool->remote_free, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&pool->remote_free, &block->next,
+				block, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		return;
+	}
+	block->next = class->free_list;
+	class->free_list = block;
+	pool->stats.in_use--;
+}
+
+void pkt_pool_get_stats(struct pkt_pool *pool, struct pkt_pool_stats *stats)
+{
+	pkt_pool_reclaim(pool);
+	*stats = pool->stats;
+}
+
+// Free memory that belongs to the packet
+void pkt_free_mem(struct pkt *pkt, void *ptr)
+{
+	if (pkt->pool)
+		pkt_pool_free(ptr);
+	else
+		free(ptr);
+}
+
+// ****************************************************************
+//
+// Input buffers
+//
+// ****************************************************************
+
+// Get unreferenced input buffer, reference count is set to 1
+// Returns NULL if the limit on number of buffers is reached
+struct pkt_input_buf *pkt_input_buf_get(struct pkt_comm *comm)
+{
+	struct pkt_input_buf *buf = comm->input_buf_free;
+	if (buf) {
+		comm->input_buf_free = buf->next;
+		comm->input_buf_free_count--;
+		buf->ref_count = 1;
+		return buf;
+	}
+
+	if (comm->input_buf_count == PKT_COMM_INPUT_BUFS_MAX)
+		return NULL;
+
+	int size = sizeof(struct pkt_input_buf) + comm->params->input_max_len;
+	buf = malloc(size);
+	if (!buf) {
+		pkt_error("pkt_input_buf_get(): unable to allocate %d bytes\n", size);
+		return NULL;
+	}
+	buf->ref_count = 1;
+	buf->comm = comm;
+	buf->data = (unsigned char *)(buf + 1);
+	comm->input_buf_count++;
+	return buf;
+}
+
+void pkt_input_buf_release(struct pkt_input_buf *buf)
+{
+	if (--buf->ref_count)
+		return;
+
+	struct pkt_comm *comm = buf->comm;
+	if (comm->input_buf_free_count == PKT_COMM_INPUT_BUFS_FREE_MAX) {
+		free(buf);
+		comm->input_buf_count--;
+		return;
+	}
+	buf->next = comm->input_buf_free;
+	comm->input_buf_free = buf;
+	comm->input_buf_free_count++;
+}
+
+// ****************************************************************
+
+struct pkt *pkt_new_pool(struct pkt_pool *pool, int type, char *data, int data_len)
 {
 	const int max_len = PKT_MAX_LEN - PKT_HEADER_LEN - 2 * PKT_CHECKSUM_LEN;
 	
@@ -33,7 +251,7 @@ struct pkt *pkt_new(int type, char *data, int data_len)
 		return NULL;
 	}
 	
-	struct pkt *pkt = malloc(sizeof(struct pkt));
+	struct pkt *pkt = pkt_pool_alloc(pool, sizeof(struct pkt));
 	if (!pkt) {
 		pkt_error("pkt_new(type %d): unable to allocate %d bytes\n",
 				type, sizeof(struct pkt));
@@ -50,19 +268,28 @@ struct pkt *pkt_new(int type, char *data, int data_len)
 	pkt->partial_header_len = 0;
 	pkt->partial_data_len = 0;
 	pkt->header = NULL;
+	pkt->pool = pool;
+	pkt->input_buf = NULL;
 	
-	total_pkt_count++;
+	__sync_fetch_and_add(&total_pkt_count, 1);
 	return pkt;
 }
 
+struct pkt *pkt_new(int type, char *data, int data_len)
+{
+	return pkt_new_pool(NULL, type, data, data_len);
+}
+
 void pkt_delete(struct pkt *pkt)
 {
-	if (pkt->data)
-		free(pkt->data);
+	if (pkt->input_buf)
+		pkt_input_buf_release(pkt->input_buf);
+	else if (pkt->data)
+		pkt_free_mem(pkt, pkt->data);
 	if (pkt->partial_header_len && pkt->header)
-		free(pkt->header);
-	free(pkt);
-	total_pkt_count--;
+		pkt_free_mem(pkt, pkt->header);
+	pkt_free_mem(pkt, pkt);
+	__sync_fetch_and_sub(&total_pkt_count, 1);
 }
 
 //
@@ -84,44 +311,194 @@ void pkt_create_header(struct pkt *pkt, unsigned char *header)
 	pkt->header[9] = pkt->id >> 8;
 }
 
+// ******************************************************************
+//
+// Checksum
+//
+// Checksum is a sum of 32-bit little-endian words, inverted.
+// Incomplete last word is padded with zeroes
+// (same as in outpkt_checksum.v, inpkt_header.v).
+//
+// ******************************************************************
+
 // Read checksum pointed to by 'src' and convert to integer type
 //
 PKT_CHECKSUM_TYPE pkt_checksum_read(unsigned char *src)
 {
-	return src[0] | (src[1] << 8) | (src[2] << 16) | (src[3] << 24);
+	return (PKT_CHECKSUM_TYPE)src[0] | ((PKT_CHECKSUM_TYPE)src[1] << 8)
+		| ((PKT_CHECKSUM_TYPE)src[2] << 16) | ((PKT_CHECKSUM_TYPE)src[3] << 24);
 }
 
-//
-// Calculate checksum of 'data' of length 'len'
-// If 'dst' is not NULL, place checksum there
-//
-PKT_CHECKSUM_TYPE pkt_checksum(unsigned char *dst, unsigned char *data, int len)
+void pkt_checksum_write(unsigned char *dst, PKT_CHECKSUM_TYPE checksum)
 {
-	PKT_CHECKSUM_TYPE checksum = 0;
-	
-	PKT_CHECKSUM_TYPE checksum_tmp = 0;
-	int checksum_byte_count = 0;
+	int i;
+	for (i = 0; i < PKT_CHECKSUM_LEN; i++)
+		dst[i] = checksum >> 8 * i;
+}
+
+// Sum of words of 'src' of length 'len' (not inverted).
+// If 'dst' is not NULL, data is also copied to 'dst'.
+typedef PKT_CHECKSUM_TYPE (*pkt_checksum_sum_fn)(unsigned char *dst,
+		unsigned char *src, int len);
 
+static PKT_CHECKSUM_TYPE pkt_checksum_sum_scalar(unsigned char *dst,
+		unsigned char *src, int len)
+{
+	PKT_CHECKSUM_TYPE sum = 0;
 	int i;
-	for (i = 0; i < len; i++) {
-		checksum_tmp |= data[i] << 8 * checksum_byte_count;
-		if (++checksum_byte_count == PKT_CHECKSUM_LEN) {
-			checksum += checksum_tmp;
-			checksum_tmp = 0;
-			checksum_byte_count = 0;
-		}
+	for (i = 0; i + PKT_CHECKSUM_LEN <= len; i += PKT_CHECKSUM_LEN)
+		sum += pkt_checksum_read(src + i);
+
+	if (i < len) {
+		unsigned char word[PKT_CHECKSUM_LEN] = { 0 };
+		memcpy(word, src + i, len - i);
+		sum += pkt_checksum_read(word);
 	}
-	checksum += checksum_tmp;
-	
-	checksum = ~checksum;
-	
-	for (i = 0; i < PKT_CHECKSUM_LEN; i++) {
+
+	if (dst)
+		memcpy(dst, src, len);
+	return sum;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PKT_CHECKSUM_X86
+#include <immintrin.h>
+
+// 32-bit lanes are added independently, carries between words
+// are discarded same way as in the scalar version.
+__attribute__((target("sse2")))
+static PKT_CHECKSUM_TYPE pkt_checksum_sum_sse2(unsigned char *dst,
+		unsigned char *src, int len)
+{
+	__m128i acc = _mm_setzero_si128();
+	int i = 0;
+	if (dst)
+		for ( ; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128((__m128i *)(src + i));
+			_mm_storeu_si128((__m128i *)(dst + i), v);
+			acc = _mm_add_epi32(acc, v);
+		}
+	else
+		for ( ; i + 16 <= len; i += 16)
+			acc = _mm_add_epi32(acc, _mm_loadu_si128((__m128i *)(src + i)));
+
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+
+	return (PKT_CHECKSUM_TYPE)_mm_cvtsi128_si32(acc)
+		+ pkt_checksum_sum_scalar(dst ? dst + i : NULL, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static PKT_CHECKSUM_TYPE pkt_checksum_sum_avx2(unsigned char *dst,
+		unsigned char *src, int len)
+{
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+	int i = 0;
+	if (dst)
+		for ( ; i + 64 <= len; i += 64) {
+			__m256i v0 = _mm256_loadu_si256((__m256i *)(src + i));
+			__m256i v1 = _mm256_loadu_si256((__m256i *)(src + i + 32));
+			_mm256_storeu_si256((__m256i *)(dst + i), v0);
+			_mm256_storeu_si256((__m256i *)(dst + i + 32), v1);
+			acc0 = _mm256_add_epi32(acc0, v0);
+			acc1 = _mm256_add_epi32(acc1, v1);
+		}
+	else
+		for ( ; i + 64 <= len; i += 64) {
+			acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((__m256i *)(src + i)));
+			acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((__m256i *)(src + i + 32)));
+		}
+
+	acc0 = _mm256_add_epi32(acc0, acc1);
+	__m128i acc = _mm_add_epi32(_mm256_castsi256_si128(acc0),
+			_mm256_extracti128_si256(acc0, 1));
+
+	// Not calling SSE2 version for the rest: mixing non-VEX
+	// SSE code with AVX code is slow on some CPUs
+	for ( ; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *)(src + i));
 		if (dst)
-			dst[i] = checksum >> 8 * i;
+			_mm_storeu_si128((__m128i *)(dst + i), v);
+		acc = _mm_add_epi32(acc, v);
 	}
+
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+
+	return (PKT_CHECKSUM_TYPE)_mm_cvtsi128_si32(acc)
+		+ pkt_checksum_sum_scalar(dst ? dst + i : NULL, src + i, len - i);
+}
+#endif
+
+static PKT_CHECKSUM_TYPE pkt_checksum_sum_init(unsigned char *dst,
+		unsigned char *src, int len);
+
+// Implementation is selected on first use.
+// Pointer is accessed atomically, checksum is used from I/O threads
+static pkt_checksum_sum_fn pkt_checksum_sum_ptr = pkt_checksum_sum_init;
+
+static inline PKT_CHECKSUM_TYPE pkt_checksum_sum(unsigned char *dst,
+		unsigned char *src, int len)
+{
+	return __atomic_load_n(&pkt_checksum_sum_ptr, __ATOMIC_RELAXED)(dst, src, len);
+}
+
+int pkt_checksum_set_impl(int impl)
+{
+	pkt_checksum_sum_fn fn = NULL;
+
+#ifdef PKT_CHECKSUM_X86
+	__builtin_cpu_init();
+	if (impl == PKT_CHECKSUM_IMPL_AUTO)
+		impl = __builtin_cpu_supports("avx2") ? PKT_CHECKSUM_IMPL_AVX2
+			: __builtin_cpu_supports("sse2") ? PKT_CHECKSUM_IMPL_SSE2
+			: PKT_CHECKSUM_IMPL_SCALAR;
+
+	if (impl == PKT_CHECKSUM_IMPL_AVX2 && __builtin_cpu_supports("avx2"))
+		fn = pkt_checksum_sum_avx2;
+	else if (impl == PKT_CHECKSUM_IMPL_SSE2 && __builtin_cpu_supports("sse2"))
+		fn = pkt_checksum_sum_sse2;
+#else
+	if (impl == PKT_CHECKSUM_IMPL_AUTO)
+		impl = PKT_CHECKSUM_IMPL_SCALAR;
+#endif
+	if (impl == PKT_CHECKSUM_IMPL_SCALAR)
+		fn = pkt_checksum_sum_scalar;
+
+	if (!fn)
+		return -1;
+	__atomic_store_n(&pkt_checksum_sum_ptr, fn, __ATOMIC_RELAXED);
+	return impl;
+}
+
+static PKT_CHECKSUM_TYPE pkt_checksum_sum_init(unsigned char *dst,
+		unsigned char *src, int len)
+{
+	pkt_checksum_set_impl(PKT_CHECKSUM_IMPL_AUTO);
+	return pkt_checksum_sum(dst, src, len);
+}
+
+//
+// Calculate checksum of 'data' of length 'len'
+// If 'dst' is not NULL, place checksum there
+//
+PKT_CHECKSUM_TYPE pkt_checksum(unsigned char *dst, unsigned char *data, int len)
+{
+	PKT_CHECKSUM_TYPE checksum = ~pkt_checksum_sum(NULL, data, len);
+	if (dst)
+		pkt_checksum_write(dst, checksum);
 	return checksum;
 }
 
+// Copy 'len' bytes from 'src' to 'dst', calculate checksum
+// while the data is being copied
+//
+PKT_CHECKSUM_TYPE pkt_checksum_copy(unsigned char *dst, unsigned char *src, int len)
+{
+	return ~pkt_checksum_sum(dst, src, len);
+}
+
 //
 // Convert binary packet header into human-readable string
 // (for debug purposes)
@@ -187,8 +564,15 @@ int pkt_process_header(struct pkt *pkt, unsigned char *header)
 
 // ****************************************************************
 
-struct pkt_queue *pkt_queue_new()
+struct pkt_queue *pkt_queue_new(int max_count)
 {
+	if (max_count < 0) {
+		pkt_error("pkt_queue_new(): bad max_count %d\n", max_count);
+		return NULL;
+	}
+	if (!max_count)
+		max_count = PKT_QUEUE_MAX;
+
 	struct pkt_queue *queue = malloc(sizeof(struct pkt_queue));
 	if (!queue) {
 		pkt_error("pkt_queue_new(): unable to allocate %d bytes\n",
@@ -196,13 +580,20 @@ struct pkt_queue *pkt_queue_new()
 		return NULL;
 	}
 	queue->count = 0;
+	queue->max_count = max_count;
+	queue->size = max_count < PKT_QUEUE_INITIAL_SIZE
+			? max_count : PKT_QUEUE_INITIAL_SIZE;
 	queue->empty_slot_idx = 0;
 	queue->first_pkt_idx = 0;
-	
-	int i;
-	for (i = 0; i < PKT_QUEUE_MAX; i++)
-		queue->pkt[i] = NULL;
-		
+	queue->total_size = 0;
+
+	queue->pkt = malloc(queue->size * sizeof(struct pkt *));
+	if (!queue->pkt) {
+		pkt_error("pkt_queue_new(): unable to allocate %d bytes\n",
+				queue->size * sizeof(struct pkt *));
+		free(queue);
+		return NULL;
+	}
 	return queue;
 }
 
@@ -213,30 +604,62 @@ void pkt_queue_delete(struct pkt_queue *queue)
 		return;
 	}
 	
-	int i;
-	for (i = 0; i < PKT_QUEUE_MAX; i++) {
-		if (queue->pkt[i])
-			pkt_delete(queue->pkt[i]);
-	}
+	struct pkt *pkt;
+	while ( (pkt = pkt_queue_fetch(queue)) )
+		pkt_delete(pkt);
+	free(queue->pkt);
 	free(queue);
 }
 
+// Double the number of slots (up to max_count)
+int pkt_queue_grow(struct pkt_queue *queue)
+{
+	int new_size = 2 * queue->size;
+	if (new_size > queue->max_count)
+		new_size = queue->max_count;
+
+	struct pkt **pkt = realloc(queue->pkt, new_size * sizeof(struct pkt *));
+	if (!pkt) {
+		pkt_error("pkt_queue_grow(): unable to allocate %d bytes\n",
+				new_size * sizeof(struct pkt *));
+		return -1;
+	}
+	queue->pkt = pkt;
+
+	// queue is full; move wrapped-around packets after the old end
+	int i;
+	for (i = 0; i < queue->empty_slot_idx; i++)
+		queue->pkt[(queue->size + i) % new_size] = queue->pkt[i];
+	queue->empty_slot_idx = (queue->size + queue->empty_slot_idx) % new_size;
+	queue->size = new_size;
+	return 0;
+}
+
+// Size of the packet in output (including headers and checksums)
+int pkt_total_size(struct pkt *pkt)
+{
+	return pkt->data_len + PKT_HEADER_LEN + 2 * PKT_CHECKSUM_LEN;
+}
+
 int pkt_queue_push(struct pkt_queue *queue, struct pkt *pkt)
 {
-	if (queue->count == PKT_QUEUE_MAX)
+	if (queue->count == queue->max_count)
+		return -1;
+	if (queue->count == queue->size && pkt_queue_grow(queue) < 0)
 		return -1;
 	
 	queue->pkt[queue->empty_slot_idx] = pkt;
-	if (++queue->empty_slot_idx == PKT_QUEUE_MAX)
+	if (++queue->empty_slot_idx == queue->size)
 		queue->empty_slot_idx = 0;
 
 	queue->count++;
+	queue->total_size += pkt_total_size(pkt);
 	return 0;
 }
 
 int pkt_queue_full(struct pkt_queue *queue, int num)
 {
-	return queue->count + num > PKT_QUEUE_MAX ? 1 : 0;
+	return queue->count + num > queue->max_count ? 1 : 0;
 }
 
 struct pkt *pkt_queue_fetch(struct pkt_queue *queue)
@@ -245,28 +668,25 @@ struct pkt *pkt_queue_fetch(struct pkt_queue *queue)
 		return NULL;
 	
 	struct pkt *pkt = queue->pkt[queue->first_pkt_idx];
-	queue->pkt[queue->first_pkt_idx] = NULL;
 	queue->count--;
+	queue->total_size -= pkt_total_size(pkt);
 
-	if (++queue->first_pkt_idx == PKT_QUEUE_MAX)
+	if (++queue->first_pkt_idx == queue->size)
 		queue->first_pkt_idx = 0;
 
 	return pkt;
 }
 
-// Get total size (including headers and checksums) of all packets in queue
-int pkt_queue_get_total_size(struct pkt_queue *queue)
+struct pkt *pkt_queue_peek(struct pkt_queue *queue)
 {
-	int total_size = 0;
-
-	int i;
-	for (i = 0; i < PKT_QUEUE_MAX; i++)
-		if (queue->pkt[i]) {
-			total_size += queue->pkt[i]->data_len + PKT_HEADER_LEN;
-			total_size += 2 * PKT_CHECKSUM_LEN;
-		}
+	if (!queue->count)
+		return NULL;
+	return queue->pkt[queue->first_pkt_idx];
+}
 
-	return total_size;
+int pkt_queue_get_total_size(struct pkt_queue *queue)
+{
+	return queue->total_size;
 }
 
 // ****************************************************************
@@ -274,7 +694,8 @@ int pkt_queue_get_total_size(struct pkt_queue *queue)
 struct pkt_comm *pkt_comm_new(struct pkt_comm_params *params)
 {
 	if (params->output_max_len <= 0 || params->input_max_len <= 0
-			|| params->alignment < 0 || params->alignment > 256) {
+			|| params->alignment < 0 || params->alignment > 256
+			|| params->alignment & (params->alignment - 1)) {
 		pkt_error("pkt_comm_new(): wrong pkt_comm_params\n");
 		return NULL;
 	}
@@ -287,25 +708,45 @@ struct pkt_comm *pkt_comm_new(struct pkt_comm_params *params)
 	}
 	comm->params = params;
 
-	comm->output_queue = pkt_queue_new();
+	comm->output_queue = pkt_queue_new(params->queue_max);
 	if (!comm->output_queue) {
 		free(comm);
 		return NULL;
 	}
-	comm->output_buf = NULL;
+	comm->output_ring = malloc(PKT_COMM_OUTPUT_RING_SIZE);
+	if (!comm->output_ring) {
+		pkt_error("pkt_comm_new(): unable to allocate %d bytes\n",
+				PKT_COMM_OUTPUT_RING_SIZE);
+		free(comm);
+		return NULL;
+	}
+	comm->output_ring_head = 0;
+	comm->output_ring_tail = 0;
+
+	comm->pool = pkt_pool_new();
+	if (!comm->pool) {
+		free(comm);
+		return NULL;
+	}
 
-	comm->input_queue = pkt_queue_new();
+	comm->input_queue = pkt_queue_new(params->queue_max);
 	if (!comm->input_queue) {
 		free(comm);
 		return NULL;
 	}
-	comm->input_buf = malloc(params->input_max_len);
-	if (!comm->input_buf) {
-		pkt_error("pkt_comm_new(): unable to allocate %d bytes\n",
-				params->input_max_len);
+	comm->input_buf_free = NULL;
+	comm->input_buf_count = 0;
+	comm->input_buf_free_count = 0;
+	comm->input_buf_pending = NULL;
+	comm->input_buf_pending_last = NULL;
+	comm->input_buf_pending_count = 0;
+	comm->input_buf_recv = NULL;
+	comm->input_buf_cur = pkt_input_buf_get(comm);
+	if (!comm->input_buf_cur) {
 		free(comm);
 		return NULL;
 	}
+	comm->input_buf = comm->input_buf_cur->data;
 	comm->input_buf_len = 0;
 	comm->input_pkt = NULL;
 
@@ -322,11 +763,25 @@ void pkt_comm_delete(struct pkt_comm *comm)
 	
 	pkt_queue_delete(comm->input_queue);
 	pkt_queue_delete(comm->output_queue);
-	free(comm->input_buf);
-	if (comm->output_buf)
-		free(comm->output_buf);
+	free(comm->output_ring);
 	if (comm->input_pkt)
 		pkt_delete(comm->input_pkt);
+
+	pkt_input_buf_release(comm->input_buf_cur);
+	while (comm->input_buf_pending) {
+		struct pkt_input_buf *buf = comm->input_buf_pending;
+		comm->input_buf_pending = buf->next;
+		pkt_input_buf_release(buf);
+	}
+	if (comm->input_buf_recv)
+		pkt_input_buf_release(comm->input_buf_recv);
+	while (comm->input_buf_free) {
+		struct pkt_input_buf *buf = comm->input_buf_free;
+		comm->input_buf_free = buf->next;
+		free(buf);
+	}
+	pkt_pool_delete(comm->pool);
+	free(comm);
 }
 
 
@@ -336,87 +791,140 @@ void pkt_comm_delete(struct pkt_comm *comm)
 //
 // ******************************************************************
 
-// allocates output buffer
-// fetches all packets from output queue and puts them into output buffer
+// Copy 'len' bytes into output ring
+void pkt_comm_output_ring_write(struct pkt_comm *comm, unsigned char *src, int len)
+{
+	unsigned int offset = comm->output_ring_head & (PKT_COMM_OUTPUT_RING_SIZE - 1);
+	int len1 = PKT_COMM_OUTPUT_RING_SIZE - offset;
+
+	if (len <= len1)
+		memcpy(comm->output_ring + offset, src, len);
+	else {
+		memcpy(comm->output_ring + offset, src, len1);
+		memcpy(comm->output_ring, src + len1, len - len1);
+	}
+	comm->output_ring_head += len;
+}
+
+// Copy packet data into output ring, return checksum of the data
+PKT_CHECKSUM_TYPE pkt_comm_output_ring_write_data(struct pkt_comm *comm,
+		unsigned char *data, int len)
+{
+	unsigned int offset = comm->output_ring_head & (PKT_COMM_OUTPUT_RING_SIZE - 1);
+	int len1 = PKT_COMM_OUTPUT_RING_SIZE - offset;
+
+	if (len <= len1) {
+		comm->output_ring_head += len;
+		return pkt_checksum_copy(comm->output_ring + offset, data, len);
+	}
+
+	// Words are counted from the start of data. Data is split
+	// at the last word boundary before the end of the ring;
+	// the word that wraps around goes through a temporary buffer.
+	int len_words = len1 & ~(PKT_CHECKSUM_LEN - 1);
+	PKT_CHECKSUM_TYPE sum = pkt_checksum_sum(comm->output_ring + offset,
+			data, len_words);
+	comm->output_ring_head += len_words;
+
+	unsigned char word[PKT_CHECKSUM_LEN];
+	int word_len = len - len_words < PKT_CHECKSUM_LEN
+			? len - len_words : PKT_CHECKSUM_LEN;
+	sum += pkt_checksum_sum(word, data + len_words, word_len);
+	pkt_comm_output_ring_write(comm, word, word_len);
+
+	int len2 = len - len_words - word_len;
+	offset = comm->output_ring_head & (PKT_COMM_OUTPUT_RING_SIZE - 1);
+	sum += pkt_checksum_sum(comm->output_ring + offset,
+			data + len_words + word_len, len2);
+	comm->output_ring_head += len2;
+	return ~sum;
+}
+
+// Serializes packet into output ring
 // calculates checksums
 // deals with alignment issues
+// Returns 0 if there's not enough space in the ring
 //
-int pkt_comm_create_output_buf(struct pkt_comm *comm)
+int pkt_comm_output_ring_add(struct pkt_comm *comm, struct pkt *pkt)
 {
-	// there's already output buffer
-	if (comm->output_buf) {
-		pkt_error("pkt_comm_create_output_buf(): buffer already created\n");
-		return -1;
-	}
-	
-	// output queue empty, output buffer not created
-	if (!comm->output_queue->count)
-		return 0;
-
-	int size = pkt_queue_get_total_size(comm->output_queue);
-	if (!size)
-		return 0;
+	int size = PKT_HEADER_LEN + pkt->data_len + 2 * PKT_CHECKSUM_LEN;
 
 	// alignment issue; pad with 0's
 	int align = comm->params->alignment;
 	int extra_zeroes = align && size % align ? align - size % align : 0;
-	size += extra_zeroes;
 
-	comm->output_buf = malloc(size);
-	if (!comm->output_buf) {
-		pkt_error("pkt_comm_create_output_buf(): unable to allocate %d bytes\n", size);
+	if (PKT_COMM_OUTPUT_RING_SIZE
+			- (comm->output_ring_head - comm->output_ring_tail)
+			< (unsigned int)(size + extra_zeroes))
 		return 0;
-	}
-	comm->output_buf_size = size;
-	comm->output_buf_offset = 0;
-	
-	int i;
-	for (i = 0; i < extra_zeroes; i++)
-		comm->output_buf[size - i - 1] = 0;
 
-	// fetch all packets from output queue and put them into output buffer
-	int offset = 0;
-	struct pkt *pkt;
-	while ( (pkt = pkt_queue_fetch(comm->output_queue)) ) {
+	unsigned char header[PKT_HEADER_LEN + PKT_CHECKSUM_LEN] = { 0 };
+	pkt_create_header(pkt, header);
+	pkt_checksum(header + PKT_HEADER_LEN, header, PKT_HEADER_LEN);
+	pkt->header = NULL;
+	pkt_comm_output_ring_write(comm, header, PKT_HEADER_LEN + PKT_CHECKSUM_LEN);
 
-		pkt_create_header(pkt, comm->output_buf + offset);
-		pkt_checksum(comm->output_buf + offset + PKT_HEADER_LEN,
-				comm->output_buf + offset, PKT_HEADER_LEN);
-		offset += PKT_HEADER_LEN + PKT_CHECKSUM_LEN;
-		
-		memcpy(comm->output_buf + offset, pkt->data, pkt->data_len);
-		pkt_checksum(comm->output_buf + offset + pkt->data_len,
-				comm->output_buf + offset, pkt->data_len);
-		offset += pkt->data_len + PKT_CHECKSUM_LEN;
+	PKT_CHECKSUM_TYPE checksum = pkt_comm_output_ring_write_data(comm,
+			pkt->data, pkt->data_len);
 
+	unsigned char trailer[PKT_CHECKSUM_LEN + 256] = { 0 };
+	pkt_checksum_write(trailer, checksum);
+	pkt_comm_output_ring_write(comm, trailer, PKT_CHECKSUM_LEN + extra_zeroes);
+	return 1;
+}
+
+// Serialize packets from output queue while there's space in the ring
+void pkt_comm_output_ring_fill(struct pkt_comm *comm)
+{
+	struct pkt *pkt;
+	while ( (pkt = pkt_queue_peek(comm->output_queue)) ) {
+		if (!pkt_comm_output_ring_add(comm, pkt))
+			break;
+		pkt_queue_fetch(comm->output_queue);
+		pkt_delete(pkt);
+	}
+}
+
+int pkt_comm_output_push(struct pkt_comm *comm, struct pkt *pkt)
+{
+	// Packets in the queue go first
+	if (!comm->output_queue->count
+			&& pkt_comm_output_ring_add(comm, pkt)) {
 		pkt_delete(pkt);
+		return 0;
 	}
 
-	return size;
+	return pkt_queue_push(comm->output_queue, pkt);
 }
 
 
+int pkt_comm_output_pending(struct pkt_comm *comm)
+{
+	return comm->output_queue->count
+		|| comm->output_ring_head != comm->output_ring_tail;
+}
+
 unsigned char *pkt_comm_get_output_data(struct pkt_comm *comm, int *len)
 {
-	if (!comm->output_buf) {
-		if (!pkt_comm_create_output_buf(comm)) {
-			// No output data
-			*len = 0;
-			return NULL;
-		}
-	}
+	pkt_comm_output_ring_fill(comm);
 
-	int size = comm->output_buf_size;
-	int offset = comm->output_buf_offset;
-	//printf("pkt: size %d off %d\n",size,offset);
-	if (size - offset <= comm->params->output_max_len) {
-		// TODO: check if there's data in output queue, add-up to buffer
-		*len = size - offset;
-	} else {
-		*len = comm->params->output_max_len;
+	unsigned int size = comm->output_ring_head - comm->output_ring_tail;
+	unsigned int offset = comm->output_ring_tail & (PKT_COMM_OUTPUT_RING_SIZE - 1);
+	if (!size) {
+		// No output data
+		*len = 0;
+		return NULL;
 	}
 
-	return comm->output_buf + offset;
+	// data from the end of the ring goes in a separate transfer
+	if (size > PKT_COMM_OUTPUT_RING_SIZE - offset)
+		size = PKT_COMM_OUTPUT_RING_SIZE - offset;
+
+	if (size > (unsigned int)comm->params->output_max_len)
+		size = comm->params->output_max_len;
+
+	*len = size;
+	return comm->output_ring + offset;
 }
 
 
@@ -426,11 +934,7 @@ void pkt_comm_output_completed(struct pkt_comm *comm, int len, int error)
 	if (error)
 		return;
 	
-	comm->output_buf_offset += len;
-	if (comm->output_buf_offset >= comm->output_buf_size) {
-		free(comm->output_buf);
-		comm->output_buf = NULL;
-	}
+	comm->output_ring_tail += len;
 }
 
 // ******************************************************************
@@ -487,14 +991,14 @@ int pkt_comm_process_input_header(struct pkt_comm *comm)
 
 		if (pkt_process_header(pkt, pkt->header) < 0)
 			return -1;
-		free(pkt->header);
+		pkt_free_mem(pkt, pkt->header);
 		pkt->header = NULL;
 		return 0;
 	}
 	
 	// Partial header of a new input packet
 	if (offset + PKT_HEADER_LEN + PKT_CHECKSUM_LEN > comm->input_buf_len) {
-		pkt->header = malloc(PKT_HEADER_LEN + PKT_CHECKSUM_LEN);
+		pkt->header = pkt_pool_alloc(pkt->pool, PKT_HEADER_LEN + PKT_CHECKSUM_LEN);
 		if (!pkt->header) {
 			pkt_error("pkt_comm_process_input_header: unable to allocate %d bytes\n",
 				PKT_HEADER_LEN + PKT_CHECKSUM_LEN);
@@ -533,14 +1037,25 @@ int pkt_comm_process_input_packet_data(struct pkt_comm *comm)
 	if (!comm->input_buf_len)
 		return 0;
 
+	int offset = comm->input_buf_offset;
+	int remains = pkt->data_len + PKT_CHECKSUM_LEN - pkt->partial_data_len;
+
 	// no data in packet
 	if (!pkt->data) {
+		// whole packet data is in input buffer; reference it
+		if (remains <= comm->input_buf_len - offset) {
+			pkt->data = comm->input_buf + offset;
+			pkt->input_buf = comm->input_buf_cur;
+			pkt->input_buf->ref_count++;
+		}
 		// allocate memory for packet data
-		pkt->data = malloc(pkt->data_len + PKT_CHECKSUM_LEN);
-		if (!pkt->data) {
-			pkt_error("pkt_comm_process_input_packet_data: unable to allocate %d bytes\n",
-				pkt->data_len + PKT_CHECKSUM_LEN);
-			return -1;
+		else {
+			pkt->data = pkt_pool_alloc(pkt->pool, pkt->data_len + PKT_CHECKSUM_LEN);
+			if (!pkt->data) {
+				pkt_error("pkt_comm_process_input_packet_data: unable to allocate %d bytes\n",
+					pkt->data_len + PKT_CHECKSUM_LEN);
+				return -1;
+			}
 		}
 	}
 	// ok, packet already has partial data
@@ -553,12 +1068,10 @@ int pkt_comm_process_input_packet_data(struct pkt_comm *comm)
 		return -1;
 	}
 
-	int offset = comm->input_buf_offset;
-	int remains = pkt->data_len + PKT_CHECKSUM_LEN - pkt->partial_data_len ;
-
 	// packet completed
 	if (remains <= comm->input_buf_len - offset) {
-		memcpy(pkt->data + pkt->partial_data_len, comm->input_buf + offset, remains);
+		if (!pkt->input_buf)
+			memcpy(pkt->data + pkt->partial_data_len, comm->input_buf + offset, remains);
 		pkt->partial_data_len = 0;
 
 		PKT_CHECKSUM_TYPE checksum = pkt_checksum(NULL, pkt->data, pkt->data_len);
@@ -640,31 +1153,73 @@ int pkt_comm_process_input_buf(struct pkt_comm *comm)
 		*/
 
 		// expecting new input packet
-		pkt = pkt_new(0, NULL, 0);
+		pkt = pkt_new_pool(comm->pool, 0, NULL, 0);
+		if (!pkt)
+			return -1;
 		comm->input_pkt = pkt;
 
 	} // while(1) - process incoming packets
 }
 
+// Process current input buffer, then received buffers waiting
+// for processing, until input queue is full
+// return < 0 on error
+//
+static int pkt_comm_process_input(struct pkt_comm *comm)
+{
+	for ( ; ; ) {
+		if (comm->input_buf_len && pkt_comm_process_input_buf(comm) < 0) {
+			comm->error = 1;
+			return -1;
+		}
+		if (comm->input_buf_len || !comm->input_buf_pending)
+			return 0;
+
+		// current buffer is processed; next one becomes current
+		struct pkt_input_buf *buf = comm->input_buf_pending;
+		comm->input_buf_pending = buf->next;
+		if (!comm->input_buf_pending)
+			comm->input_buf_pending_last = NULL;
+		comm->input_buf_pending_count--;
+
+		pkt_input_buf_release(comm->input_buf_cur);
+		comm->input_buf_cur = buf;
+		comm->input_buf = buf->data;
+		comm->input_buf_len = buf->len;
+		comm->input_buf_offset = 0;
+	}
+}
+
 unsigned char *pkt_comm_input_get_buf(struct pkt_comm *comm)
 {
-	// input queue full
-	if (pkt_queue_full(comm->input_queue, 1))
-		return NULL;
-		
 	// input buffer not empty
 	// that's probably because input queue was full
 	// at time of processing
+	if (pkt_comm_process_input(comm) < 0)
+		return NULL;
+
+	if (comm->input_buf_recv)
+		return comm->input_buf_recv->data;
+
+	// still not empty: receive into another buffer,
+	// it waits for processing
 	if (comm->input_buf_len) {
-		// try to process and empty it
-		if (pkt_comm_process_input_buf(comm) < 0) {
-			comm->error = 1;
+		if (comm->input_buf_pending_count == PKT_COMM_INPUT_BUFS_PENDING_MAX)
 			return NULL;
-		}
+		comm->input_buf_recv = pkt_input_buf_get(comm);
+		if (!comm->input_buf_recv)
+			return NULL;
+		return comm->input_buf_recv->data;
+	}
 
-		// still not empty
-		if (comm->input_buf_len)
+	// Received packets still reference the current buffer
+	if (comm->input_buf_cur->ref_count > 1) {
+		struct pkt_input_buf *buf = pkt_input_buf_get(comm);
+		if (!buf)
 			return NULL;
+		pkt_input_buf_release(comm->input_buf_cur);
+		comm->input_buf_cur = buf;
+		comm->input_buf = buf->data;
 	}
 
 	comm->input_buf_offset = 0;
@@ -674,23 +1229,31 @@ unsigned char *pkt_comm_input_get_buf(struct pkt_comm *comm)
 int pkt_comm_input_completed(struct pkt_comm *comm, int len, int error)
 {
 	//printf("input_completed %d %d\n", len, error);
-	comm->error = error;
-	if (error)
-		return -1;
+	struct pkt_input_buf *buf = comm->input_buf_recv;
+	comm->input_buf_recv = NULL;
 
-	if (!len)
-		return -1;
-	if (len > comm->params->input_max_len) {
-		pkt_error("pkt_comm_input_completed: len %d exceeds input_max_len(%d)\n",
-				len, comm->params->input_max_len);
+	comm->error = error;
+	if (error || !len || len > comm->params->input_max_len) {
+		if (len > comm->params->input_max_len)
+			pkt_error("pkt_comm_input_completed: len %d exceeds input_max_len(%d)\n",
+					len, comm->params->input_max_len);
+		if (buf)
+			pkt_input_buf_release(buf);
 		return -1;
 	}
-	comm->input_buf_len = len;
-		
-	if (pkt_comm_process_input_buf(comm) < 0) {
-		comm->error = 1;
-		return -1;
+
+	if (buf) {
+		buf->len = len;
+		buf->next = NULL;
+		if (comm->input_buf_pending_last)
+			comm->input_buf_pending_last->next = buf;
+		else
+			comm->input_buf_pending = buf;
+		comm->input_buf_pending_last = buf;
+		comm->input_buf_pending_count++;
 	}
-	return 0;
-}
+	else
+		comm->input_buf_len = len;
 
+	return pkt_comm_process_input(comm);
+}
@@ -42,10 +42,13 @@
 #define PKT_MAX_LEN	(4 * 65536) // 256K
 
 #define PKT_CHECKSUM_LEN	4
-// PKT_CHECKSUM_TYPE must be unsigned type
-#define PKT_CHECKSUM_TYPE	unsigned long
+// PKT_CHECKSUM_TYPE must be unsigned 32-bit type
+#define PKT_CHECKSUM_TYPE	unsigned int
 //#define PKT_CHECKSUM_INTERVAL	448
 
+struct pkt_pool;
+struct pkt_input_buf;
+
 struct pkt {
 	unsigned char version;
 	unsigned char type; // type must be > 0
@@ -58,20 +61,117 @@ struct pkt {
 	int partial_data_len;
 	// variable usage for output and input
 	unsigned char *header;
+	// 'struct pkt' and data allocated from the pool (NULL: from heap)
+	struct pkt_pool *pool;
+	// received packet: data points into link layer input buffer
+	struct pkt_input_buf *input_buf;
 };
 
 // Currently error messages are printed to stderr
 void pkt_error(const char *s, ...);
 
 // Total number of packets created with pkt_new() and not yet deleted
+// (packets may be created and deleted in different threads)
 int get_pkt_count(void);
 
+// *****************************************************************
+//
+// Packet pool
+//
+// Slab allocator for 'struct pkt' and packet data, one per pkt_comm.
+// Blocks come from size classes, memory is taken from the heap
+// in slabs and returned only when the pool is deleted.
+// Larger allocations go to the heap.
+//
+// Pool is allocated from by one thread (owner, the last thread that
+// allocated). Memory can be freed in any thread: blocks freed
+// by other threads go to a lock-free list, the owner takes them
+// back when a size class runs out of free blocks.
+// Ownership moves with the next allocation from another thread
+// (e.g. pool created by the main thread, used by a board worker).
+// The previous owner must be done allocating by then and the handoff
+// must be ordered by something else (thread start, a ring). The owner
+// is published with release/acquire, a thread that freed as owner
+// before the handoff never sees itself as owner after it.
+//
+// *****************************************************************
+
+// 64: 'struct pkt', packets from the device (PKT_TYPE_CMP_EQUAL etc.)
+// 1024: WORD_GEN_MAX_SIZE
+// 8192: CMP_CONFIG_MAX_SIZE
+// 65536: WORD_LIST_PKT_LEN (slab has 1 block)
+#define PKT_POOL_NUM_CLASSES	4
+#define PKT_POOL_CLASS_SIZES	{ 64, 1024, 8192, 65536 }
+#define PKT_POOL_SLAB_SIZE		65536
+
+struct pkt_pool_block;
+
+struct pkt_pool_class {
+	struct pkt_pool *pool;
+	int size;
+	struct pkt_pool_block *free_list;
+};
+
+struct pkt_pool_stats {
+	unsigned long alloc_count;	// allocations served by the pool
+	unsigned long heap_count;	// allocations that went to the heap
+	int slab_count;
+	int in_use;					// blocks currently allocated
+};
+
+struct pkt_pool {
+	struct pkt_pool_class class[PKT_POOL_NUM_CLASSES];
+	void *slab;
+	struct pkt_pool_stats stats;
+	void *owner;
+	// blocks freed by other threads
+	struct pkt_pool_block *remote_free;
+};
+
+struct pkt_pool *pkt_pool_new();
+
+// Memory allocated from the pool must be freed before pool is deleted
+void pkt_pool_delete(struct pkt_pool *pool);
+
+// If 'pool' is NULL, allocates from the heap
+void *pkt_pool_alloc(struct pkt_pool *pool, int size);
+
+// Frees memory allocated from the pool, can be called in any thread
+void pkt_pool_free(void *ptr);
+
+// Pool usage counters. Called by the owner
+void pkt_pool_get_stats(struct pkt_pool *pool, struct pkt_pool_stats *stats);
+
 // Creates new packet. Does not allocate memory for data
 struct pkt *pkt_new(int type, char *data, int data_len);
 
+// Creates new packet in the pool. 'data' must be allocated from the
+// same pool (if pool is NULL, same as pkt_new())
+struct pkt *pkt_new_pool(struct pkt_pool *pool, int type, char *data, int data_len);
+
 // Deletes packet, also frees pkt->data
 void pkt_delete(struct pkt *pkt);
 
+// Checksum implementations. Best available one is selected on first use.
+#define PKT_CHECKSUM_IMPL_AUTO		0
+#define PKT_CHECKSUM_IMPL_SCALAR	1
+#define PKT_CHECKSUM_IMPL_SSE2		2
+#define PKT_CHECKSUM_IMPL_AVX2		3
+
+// Selects checksum implementation.
+// Returns selected implementation or -1 if it's not supported
+int pkt_checksum_set_impl(int impl);
+
+// Calculates checksum of 'data'. If 'dst' is not NULL, places checksum there
+PKT_CHECKSUM_TYPE pkt_checksum(unsigned char *dst, unsigned char *data, int len);
+
+// Copies 'len' bytes from 'src' to 'dst', returns checksum of the data
+PKT_CHECKSUM_TYPE pkt_checksum_copy(unsigned char *dst, unsigned char *src, int len);
+
+PKT_CHECKSUM_TYPE pkt_checksum_read(unsigned char *src);
+
+void pkt_checksum_write(unsigned char *dst, PKT_CHECKSUM_TYPE checksum);
+
 
 // *****************************************************************
 // 
@@ -79,16 +179,23 @@ void pkt_delete(struct pkt *pkt);
 //
 // *****************************************************************
 
+// Default max. number of packets in queue
 #define PKT_QUEUE_MAX	2000
+// Queue starts with that many slots and grows as needed
+#define PKT_QUEUE_INITIAL_SIZE	16
 
 struct pkt_queue {
 	int count;			// number of packets currently in queue
+	int max_count;		// queue doesn't grow beyond that
+	int size;			// number of allocated slots
 	int empty_slot_idx;	// index of 1st empty slot
 	int first_pkt_idx;	// index of first packet
-	struct pkt *pkt[PKT_QUEUE_MAX];
+	int total_size;		// total size of packets (including headers and checksums)
+	struct pkt **pkt;
 };
 
-struct pkt_queue *pkt_queue_new();
+// 'max_count' is max. number of packets, 0 for PKT_QUEUE_MAX
+struct pkt_queue *pkt_queue_new(int max_count);
 
 void pkt_queue_delete(struct pkt_queue *queue);
 
@@ -101,6 +208,13 @@ int pkt_queue_push(struct pkt_queue *queue, struct pkt *pkt);
 // returns NULL if queue is empty
 struct pkt *pkt_queue_fetch(struct pkt_queue *queue);
 
+// Get total size (including headers and checksums) of all packets in queue
+int pkt_queue_get_total_size(struct pkt_queue *queue);
+
+// returns first packet without removing it from the queue
+// returns NULL if queue is empty
+struct pkt *pkt_queue_peek(struct pkt_queue *queue);
+
 
 // *****************************************************************
 //
@@ -115,21 +229,67 @@ struct pkt *pkt_queue_fetch(struct pkt_queue *queue);
 
 // Parameters for link layer
 struct pkt_comm_params {
-	int alignment;
+	int alignment;		// must be a power of 2
 	int output_max_len;	// link layer max. transmit length
 	int input_max_len;	// link layer max. receive length
+	int queue_max;		// max. packets in input and output queues, 0 for default
+};
+
+// *****************************************************************
+//
+// Input buffers
+//
+// Link layer input goes into reference counted buffers. Received
+// packets that are entirely inside a buffer point into it,
+// their data isn't copied. The buffer is reused after all such
+// packets are deleted. Only packets that span two link layer reads
+// are copied.
+//
+// If received data can't be processed at once (input queue is full),
+// further link layer reads go into more buffers. Such buffers wait
+// for processing in the order of receipt.
+//
+// *****************************************************************
+
+// That many unreferenced buffers are kept for reuse
+#define PKT_COMM_INPUT_BUFS_FREE_MAX	4
+// Max. number of received buffers waiting for processing
+#define PKT_COMM_INPUT_BUFS_PENDING_MAX	8
+// Max. number of input buffers per pkt_comm: waiting ones, plus
+// the one being processed and ones still referenced by received
+// packets, as many as fit the free list once packets are deleted
+#define PKT_COMM_INPUT_BUFS_MAX	\
+	(PKT_COMM_INPUT_BUFS_PENDING_MAX + PKT_COMM_INPUT_BUFS_FREE_MAX)
+
+struct pkt_input_buf {
+	int ref_count;
+	struct pkt_comm *comm;
+	struct pkt_input_buf *next;	// in the free or pending list
+	unsigned char *data;
+	int len;					// received data, waits for processing
 };
 
 struct pkt_comm {
 	struct pkt_comm_params *params;
 	
 	struct pkt_queue *output_queue;
-	unsigned char *output_buf;
-	int output_buf_size;
-	int output_buf_offset;
+	// packets are serialized into output ring
+	unsigned char *output_ring;
+	unsigned int output_ring_head, output_ring_tail;
 
+	// packets from the device are allocated in the pool
+	struct pkt_pool *pool;
 	struct pkt_queue *input_queue;
-	unsigned char *input_buf;
+	struct pkt_input_buf *input_buf_cur;
+	struct pkt_input_buf *input_buf_free;
+	int input_buf_count;		// allocated input buffers
+	int input_buf_free_count;
+	// received buffers waiting for processing
+	struct pkt_input_buf *input_buf_pending, *input_buf_pending_last;
+	int input_buf_pending_count;
+	// buffer given to link layer, if not the current one
+	struct pkt_input_buf *input_buf_recv;
+	unsigned char *input_buf;	// data of the current input buffer
 	int input_buf_len;
 	int input_buf_offset;
 	struct pkt *input_pkt;
@@ -137,10 +297,22 @@ struct pkt_comm {
 	int error;
 };
 
+// Output ring must hold the largest packet
+#define PKT_COMM_OUTPUT_RING_SIZE	(2 * PKT_MAX_LEN)
+
 struct pkt_comm *pkt_comm_new(struct pkt_comm_params *params);
 
+// Received packets must be deleted before pkt_comm_delete()
 void pkt_comm_delete(struct pkt_comm *comm);
 
+// Put packet for output. Packet is serialized into output ring
+// immediately if there's space, else it waits in output queue.
+// Returns -1 if output queue is full
+int pkt_comm_output_push(struct pkt_comm *comm, struct pkt *pkt);
+
+// Returns true if there's data waiting for output
+int pkt_comm_output_pending(struct pkt_comm *comm);
+
 
 // *****************************************************************
 //
@@ -158,7 +330,9 @@ unsigned char *pkt_comm_get_output_data(struct pkt_comm *comm, int *len);
 void pkt_comm_output_completed(struct pkt_comm *comm, int len, int error);
 
 // Get buffer for link layer input
-// Return NULL if input is full
+// Return NULL if input is full (PKT_COMM_INPUT_BUFS_PENDING_MAX buffers
+// wait for processing, or all input buffers are referenced
+// by received packets)
 unsigned char *pkt_comm_input_get_buf(struct pkt_comm *comm);
 
 // Called after data was received into buffer requested with pkt_comm_input_get_buf()
@@ -12,10 +12,10 @@ struct word_gen word_gen_words_pass_by = {
 };
 
 
-struct pkt *pkt_word_gen_new(struct word_gen *word_gen)
+struct pkt *pkt_word_gen_new_pool(struct pkt_pool *pool, struct word_gen *word_gen)
 {
 
-	char *data = malloc(WORD_GEN_MAX_SIZE);
+	char *data = pkt_pool_alloc(pool, WORD_GEN_MAX_SIZE);
 	if (!data) {
 		pkt_error("pkt_word_gen_new(): unable to allocate %d bytes\n",
 				WORD_GEN_MAX_SIZE);
@@ -48,7 +48,12 @@ struct pkt *pkt_word_gen_new(struct word_gen *word_gen)
 
 	data[offset++] = 0xBB;
 	
-	struct pkt *pkt = pkt_new(PKT_TYPE_WORD_GEN, data, offset);
+	struct pkt *pkt = pkt_new_pool(pool, PKT_TYPE_WORD_GEN, data, offset);
 	//printf("pkt_word_gen_new: data_len %d\n", offset);
 	return pkt;
 }
+
+struct pkt *pkt_word_gen_new(struct word_gen *word_gen)
+{
+	return pkt_word_gen_new_pool(NULL, word_gen);
+}
@@ -37,3 +37,6 @@ struct word_gen word_gen_words_pass_by;
 
 struct pkt *pkt_word_gen_new(struct word_gen *word_gen);
 
+// Packet and its data are allocated from the pool
+struct pkt *pkt_word_gen_new_pool(struct pkt_pool *pool, struct word_gen *word_gen);
+
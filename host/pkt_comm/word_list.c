@@ -1,8 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "pkt_comm.h"
+#include "word_gen.h"
 #include "word_list.h"
 
 struct pkt *pkt_word_list_new(char **words)
@@ -29,3 +35,188 @@ struct pkt *pkt_word_list_new(char **words)
 	return pkt;
 }
 
+
+
+struct word_list_stream *word_list_stream_new(char *data, size_t size,
+		int pkt_len)
+{
+	const int max_len = PKT_MAX_LEN - PKT_HEADER_LEN - 2 * PKT_CHECKSUM_LEN;
+	if (pkt_len < 0 || pkt_len > max_len || (pkt_len && pkt_len <= WORD_MAX_LEN)) {
+		pkt_error("word_list_stream_new(): bad pkt_len %d\n", pkt_len);
+		return NULL;
+	}
+
+	struct word_list_stream *stream = calloc(1, sizeof(struct word_list_stream));
+	if (!stream) {
+		pkt_error("word_list_stream_new(): unable to allocate %d bytes\n",
+				sizeof(struct word_list_stream));
+		return NULL;
+	}
+	stream->fd = -1;
+	stream->data = data;
+	stream->size = size;
+	stream->pkt_len = pkt_len ? pkt_len : WORD_LIST_PKT_LEN;
+	stream->max_words = WORD_LIST_WORDS_MAX;
+	return stream;
+}
+
+struct word_list_stream *word_list_stream_open(char *path, int pkt_len)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		pkt_error("word_list_stream_open(): %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		pkt_error("word_list_stream_open(): %s: %s\n", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	char *data = NULL;
+	if (st.st_size) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			pkt_error("word_list_stream_open(): mmap %s: %s\n",
+					path, strerror(errno));
+			close(fd);
+			return NULL;
+		}
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	struct word_list_stream *stream = word_list_stream_new(data, st.st_size, pkt_len);
+	if (!stream) {
+		if (data)
+			munmap(data, st.st_size);
+		close(fd);
+		return NULL;
+	}
+	stream->fd = fd;
+	return stream;
+}
+
+void word_list_stream_delete(struct word_list_stream *stream)
+{
+	if (stream->fd != -1) {
+		if (stream->data)
+			munmap(stream->data, stream->size);
+		close(stream->fd);
+	}
+	free(stream);
+}
+
+// Pages already streamed aren't kept in memory
+static void word_list_stream_release(struct word_list_stream *stream)
+{
+	if (stream->fd == -1)
+		return;
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t end = stream->offset / page_size * page_size;
+	if (end <= stream->released)
+		return;
+	madvise(stream->data + stream->released, end - stream->released,
+			MADV_DONTNEED);
+	stream->released = end;
+}
+
+void word_list_stream_set_max_words(struct word_list_stream *stream,
+		int max_words)
+{
+	stream->max_words = max_words < 1 ? 1
+			: max_words > WORD_LIST_WORDS_MAX ? WORD_LIST_WORDS_MAX : max_words;
+}
+
+struct pkt *word_list_stream_next_pool(struct word_list_stream *stream,
+		struct pkt_pool *pool, size_t *offset)
+{
+	char *data = NULL;
+	int len = 0;
+	int num_words = 0;
+
+	while (stream->offset < stream->size && num_words < stream->max_words) {
+		char *line = stream->data + stream->offset;
+		size_t avail = stream->size - stream->offset;
+		char *eol = memchr(line, '\n', avail);
+		size_t line_len = eol ? (size_t)(eol - line) : avail;
+		// Skipped words before 'scanned' were counted before seek
+		int counted = stream->offset < stream->scanned;
+
+		int word_len = line_len;
+		if (word_len && line[word_len - 1] == '\r')
+			word_len--;
+		if (!word_len) {
+			stream->offset += line_len + (eol ? 1 : 0);
+			continue;
+		}
+
+		int i;
+		for (i = 0; i < word_len && i <= WORD_MAX_LEN; i++)
+			if (!line[i] || (unsigned char)line[i] >> CHAR_BITS)
+				break;
+		if (i != word_len || word_len > WORD_MAX_LEN) {
+			if (!counted)
+				stream->skip_count++;
+			stream->offset += line_len + (eol ? 1 : 0);
+			continue;
+		}
+
+		// Word doesn't fit, it goes into the next packet
+		if (len + word_len + 1 > stream->pkt_len)
+			break;
+		if (!data) {
+			data = pkt_pool_alloc(pool, stream->pkt_len);
+			if (!data) {
+				pkt_error("word_list_stream_next(): unable to allocate %d bytes\n",
+						stream->pkt_len);
+				return NULL;
+			}
+			if (offset)
+				*offset = stream->offset;
+		}
+		memcpy(data + len, line, word_len);
+		data[len + word_len] = 0;
+		len += word_len + 1;
+		num_words++;
+		stream->offset += line_len + (eol ? 1 : 0);
+	}
+
+	if (stream->offset > stream->scanned)
+		stream->scanned = stream->offset;
+	word_list_stream_release(stream);
+	if (!data)
+		return NULL;
+
+	struct pkt *pkt = pkt_new_pool(pool, PKT_TYPE_WORD_LIST, data, len);
+	if (!pkt) {
+		if (pool)
+			pkt_pool_free(data);
+		else
+			free(data);
+		return NULL;
+	}
+	stream->word_count += num_words;
+	return pkt;
+}
+
+struct pkt *word_list_stream_next(struct word_list_stream *stream,
+		size_t *offset)
+{
+	return word_list_stream_next_pool(stream, NULL, offset);
+}
+
+void word_list_stream_seek(struct word_list_stream *stream, size_t offset)
+{
+	if (offset > stream->size)
+		offset = stream->size;
+	stream->offset = offset;
+	// Released pages are re-read from the file
+	if (stream->released > offset)
+		stream->released = offset / sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE);
+}
+
+int word_list_stream_end(struct word_list_stream *stream)
+{
+	return stream->offset >= stream->size;
+}
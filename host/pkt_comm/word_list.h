@@ -8,3 +8,74 @@
 // ***************************************************************
 
 struct pkt *pkt_word_list_new(char **words);
+
+
+// ***************************************************************
+//
+// Word List streaming
+//
+// * Words are read from memory-mapped file (or memory buffer),
+//   one word per line, constant memory is used.
+// * Words longer than WORD_MAX_LEN, with chars beyond CHAR_BITS
+//   and empty lines are skipped.
+// * Packets are up to 'pkt_len' bytes of data (default
+//   WORD_LIST_PKT_LEN) and up to 'max_words' words
+//   (default WORD_LIST_WORDS_MAX).
+// * Each packet must follow WORD_GEN packet (word_gen.v finishes
+//   the configuration at the end of the word list).
+// * Packets are created on demand. Backpressure: caller creates
+//   next packet when the previous one can be sent (e.g. it keeps
+//   a limited number of packets in flight).
+//
+// ***************************************************************
+
+// word_id is 16-bit, word_list.v flags an error on 65536th word
+#define WORD_LIST_WORDS_MAX	65535
+// Several link layer transfers (pkt_comm_params.output_max_len)
+#define WORD_LIST_PKT_LEN	65536
+
+struct word_list_stream {
+	int fd;					// -1 if not memory-mapped
+	char *data;
+	size_t size;
+	size_t offset;			// next packet starts here
+	size_t released;		// pages below that were released
+	int pkt_len;
+	int max_words;
+	size_t scanned;			// skipped words below that were counted
+	unsigned long long word_count;	// words put into packets
+	unsigned long long skip_count;	// words skipped (too long, bad chars)
+};
+
+// 'pkt_len' is max. data length of packets, 0 for default
+struct word_list_stream *word_list_stream_open(char *path, int pkt_len);
+
+// Words are from memory buffer, it must remain valid until
+// the stream is deleted
+struct word_list_stream *word_list_stream_new(char *data, size_t size,
+		int pkt_len);
+
+void word_list_stream_delete(struct word_list_stream *stream);
+
+// Sets max. number of words in next packets
+// (up to WORD_LIST_WORDS_MAX)
+void word_list_stream_set_max_words(struct word_list_stream *stream,
+		int max_words);
+
+// Creates next WORD_LIST packet (allocated from the heap).
+// Sets 'offset' (if not NULL) to the position in the file where
+// packet's words start. Returns NULL at the end of file
+struct pkt *word_list_stream_next(struct word_list_stream *stream,
+		size_t *offset);
+
+// Packet and its data are allocated from the pool
+struct pkt *word_list_stream_next_pool(struct word_list_stream *stream,
+		struct pkt_pool *pool, size_t *offset);
+
+// Continues from the given position (e.g. words of a packet
+// that wasn't processed are streamed again). Words skipped
+// before aren't counted again
+void word_list_stream_seek(struct word_list_stream *stream, size_t offset);
+
+// Returns true if there are no more words
+int word_list_stream_end(struct word_list_stream *stream);
@@ -370,7 +370,7 @@ int main(int argc, char **argv)
 					break;
 				outpkt = pkt_word_gen_new(&word_gen_test_input_bandwith);
 				outpkt->id = pkt_id++;
-				pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
+				pkt_comm_output_push(device->fpga[0].comm, outpkt);
 			}
 			*/
 			
@@ -379,17 +379,17 @@ int main(int argc, char **argv)
 					break;
 				outpkt = pkt_word_gen_new(&word_gen_100k);
 				outpkt->id = pkt_id++;
-				pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
+				pkt_comm_output_push(device->fpga[0].comm, outpkt);
 			}
 			
 			if (pkt_queue_full(device->fpga[0].comm->output_queue, 2))
 				break;
 			outpkt = pkt_word_gen_new(&word_gen_word1k);
 			outpkt->id = pkt_id++;
-			pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
+			pkt_comm_output_push(device->fpga[0].comm, outpkt);
 		
 			outpkt = pkt_word_list_new(words);
-			pkt_queue_push(device->fpga[0].comm->output_queue, outpkt);
+			pkt_comm_output_push(device->fpga[0].comm, outpkt);
 			
 			//sent=1;
 
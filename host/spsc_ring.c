@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "spsc_ring.h"
+
+
+struct spsc_ring *spsc_ring_new(int size)
+{
+	if (size <= 0) {
+		fprintf(stderr, "spsc_ring_new(): bad size %d\n", size);
+		return NULL;
+	}
+	unsigned int ring_size = 1;
+	while (ring_size < (unsigned int)size)
+		ring_size <<= 1;
+
+	struct spsc_ring *ring = aligned_alloc(SPSC_RING_CACHE_LINE,
+			(sizeof(struct spsc_ring) + SPSC_RING_CACHE_LINE - 1)
+			& ~(SPSC_RING_CACHE_LINE - 1));
+	if (!ring)
+		return NULL;
+	ring->slot = malloc(ring_size * sizeof(void *));
+	if (!ring->slot) {
+		free(ring);
+		return NULL;
+	}
+	ring->size = ring_size;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return ring;
+}
+
+void spsc_ring_delete(struct spsc_ring *ring)
+{
+	free(ring->slot);
+	free(ring);
+}
+
+int spsc_ring_push(struct spsc_ring *ring, void *ptr)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail == ring->size)
+		return -1;
+
+	ring->slot[head & (ring->size - 1)] = ptr;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return 0;
+}
+
+void *spsc_ring_pop(struct spsc_ring *ring)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (head == tail)
+		return NULL;
+
+	void *ptr = ring->slot[tail & (ring->size - 1)];
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return ptr;
+}
+
+void *spsc_ring_peek(struct spsc_ring *ring)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (head == tail)
+		return NULL;
+
+	return ring->slot[tail & (ring->size - 1)];
+}
+
+int spsc_ring_count(struct spsc_ring *ring)
+{
+	return atomic_load_explicit(&ring->head, memory_order_acquire)
+		- atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
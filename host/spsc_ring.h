@@ -0,0 +1,38 @@
+//===============================================================
+//
+// Single-producer single-consumer lock-free ring of pointers.
+// One thread pushes, another one pops.
+//
+//===============================================================
+
+#include <stdatomic.h>
+
+#define SPSC_RING_CACHE_LINE	64
+
+struct spsc_ring {
+	unsigned int size;		// power of 2
+	void **slot;
+	// head is written by producer, tail by consumer.
+	// Kept in separate cache lines.
+	_Alignas(SPSC_RING_CACHE_LINE) atomic_uint head;
+	_Alignas(SPSC_RING_CACHE_LINE) atomic_uint tail;
+};
+
+// 'size' (> 0) is rounded up to a power of 2
+struct spsc_ring *spsc_ring_new(int size);
+
+void spsc_ring_delete(struct spsc_ring *ring);
+
+// Producer. Returns -1 if ring is full
+int spsc_ring_push(struct spsc_ring *ring, void *ptr);
+
+// Consumer. Returns NULL if ring is empty
+void *spsc_ring_pop(struct spsc_ring *ring);
+
+// Consumer. Returns next element without removing it,
+// NULL if ring is empty
+void *spsc_ring_peek(struct spsc_ring *ring);
+
+// Number of elements (approximate if called while the other side
+// is active)
+int spsc_ring_count(struct spsc_ring *ring);
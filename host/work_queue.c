@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "work_queue.h"
+
+uint64_t work_queue_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int work_queue_max_units(struct work_queue *queue)
+{
+	return queue->max_units ? queue->max_units : WORK_QUEUE_UNITS;
+}
+
+int work_queue_full(struct work_queue *queue)
+{
+	return queue->num_units >= work_queue_max_units(queue);
+}
+
+uint64_t work_queue_count(struct work_queue *queue, uint64_t remaining,
+		double total_rate)
+{
+	if (queue->rate <= 0)
+		return WORK_QUEUE_COUNT_INITIAL;
+
+	uint64_t count = queue->rate * (queue->target_usec ? queue->target_usec
+			: WORK_QUEUE_USEC) / 1000000;
+	// FPGA's share of the rest, halved
+	if (total_rate > 0) {
+		uint64_t share = remaining * (queue->rate / total_rate) / 2;
+		if (share < count)
+			count = share;
+	}
+	return count ? count : 1;
+}
+
+struct work_unit *work_queue_add(struct work_queue *queue,
+		unsigned short pkt_id, uint64_t start, uint64_t count)
+{
+	if (queue->num_units == WORK_QUEUE_UNITS_MAX)
+		return NULL;
+
+	// FPGA was idle since the previous unit was done
+	if (!queue->num_units && !queue->no_work && queue->last_done_usec
+			&& queue->rate > 0) {
+		queue->num_starved++;
+		if (work_queue_max_units(queue) < WORK_QUEUE_UNITS_MAX)
+			queue->max_units = work_queue_max_units(queue) + 1;
+	}
+
+	queue->no_work = 0;
+
+	struct work_unit *unit = &queue->unit[queue->num_units++];
+	unit->pkt_id = pkt_id;
+	unit->start = start;
+	unit->count = count;
+	unit->sent_usec = work_queue_usec();
+	return unit;
+}
+
+void work_queue_no_work(struct work_queue *queue)
+{
+	queue->no_work = 1;
+}
+
+int work_queue_find(struct work_queue *queue, unsigned short pkt_id)
+{
+	int i;
+	for (i = 0; i < queue->num_units; i++)
+		if (queue->unit[i].pkt_id == pkt_id)
+			return i;
+	return -1;
+}
+
+int work_queue_done(struct work_queue *queue, unsigned short pkt_id,
+		unsigned int num_processed, struct work_unit *unit)
+{
+	int i = work_queue_find(queue, pkt_id);
+	if (i == -1)
+		return -1;
+
+	struct work_unit *done = &queue->unit[i];
+	uint64_t now = work_queue_usec();
+
+	// Processing started after the previous unit was done.
+	// Several PROCESSING_DONE can be received at once, so the rate
+	// is the ratio of sums over recent units, older ones fade out
+	uint64_t start = done->sent_usec > queue->last_done_usec
+			? done->sent_usec : queue->last_done_usec;
+	if (queue->rate_usec > WORK_QUEUE_RATE_USEC) {
+		queue->rate_count /= 2;
+		queue->rate_usec /= 2;
+	}
+	queue->rate_count += num_processed;
+	queue->rate_usec += now > start ? now - start : 0;
+	if (queue->rate_usec)
+		queue->rate = (double)queue->rate_count * 1000000 / queue->rate_usec;
+	queue->last_done_usec = now;
+
+	if (unit)
+		*unit = *done;
+	queue->num_units--;
+	memmove(done, done + 1, (queue->num_units - i) * sizeof(struct work_unit));
+	return 0;
+}
+
+int work_queue_cancel(struct work_queue *queue, unsigned short pkt_id,
+		struct work_unit *unit)
+{
+	int i = work_queue_find(queue, pkt_id);
+	if (i == -1)
+		return -1;
+
+	if (unit)
+		*unit = queue->unit[i];
+	queue->num_units--;
+	memmove(&queue->unit[i], &queue->unit[i + 1],
+			(queue->num_units - i) * sizeof(struct work_unit));
+	return 0;
+}
+
+void work_queue_clear(struct work_queue *queue)
+{
+	queue->num_units = 0;
+	queue->rate = 0;
+	queue->rate_count = 0;
+	queue->rate_usec = 0;
+	queue->last_done_usec = 0;
+}
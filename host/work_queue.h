@@ -0,0 +1,89 @@
+//===============================================================
+//
+// Per-FPGA work queue.
+//
+// * Work unit is a packet that produces candidates (WORD_GEN,
+//   possibly followed with WORD_LIST). Unit has 'start' (position
+//   in the source of work, e.g. keyspace or word list) and 'count'
+//   of candidates.
+// * FPGA keeps up to 'max_units' units outstanding, next units wait
+//   in FPGA's input while the current one is processed. If FPGA
+//   runs out of units (unit is added after the previous one is
+//   done) while there was work for it, 'max_units' is increased
+//   up to WORK_QUEUE_UNITS_MAX.
+// * Unit size is computed so the unit takes 'target_usec' at FPGA's
+//   rate. Rate is measured from num_processed of PROCESSING_DONE.
+// * Near the end of work, units get smaller (FPGA's share of the
+//   rest, halved), so all FPGAs finish at about the same time.
+// * Zeroed struct is an empty queue with default parameters.
+//
+//===============================================================
+
+#include <stdint.h>
+
+#define WORK_QUEUE_UNITS_MAX	8
+#define WORK_QUEUE_UNITS		2
+// Target wall time of a unit
+#define WORK_QUEUE_USEC			200000
+// Unit size until the FPGA's rate is measured
+#define WORK_QUEUE_COUNT_INITIAL	(1 << 20)
+// Rate is measured over that interval (approx.)
+#define WORK_QUEUE_RATE_USEC	1000000
+
+struct work_unit {
+	unsigned short pkt_id;
+	uint64_t start;
+	uint64_t count;
+	uint64_t sent_usec;
+};
+
+struct work_queue {
+	double rate;				// candidates/s, 0 if not measured yet
+	uint64_t target_usec;		// 0 for WORK_QUEUE_USEC
+	int max_units;				// 0 for WORK_QUEUE_UNITS
+	int num_units;
+	struct work_unit unit[WORK_QUEUE_UNITS_MAX];	// in order sent
+	uint64_t last_done_usec;
+	// candidates processed and time taken, recent units
+	uint64_t rate_count, rate_usec;
+	int no_work;				// source of work had nothing for the FPGA
+	int num_starved;			// times FPGA ran out of units
+};
+
+// Monotonic time, usec
+uint64_t work_queue_usec();
+
+// FPGA has 'max_units' outstanding
+int work_queue_full(struct work_queue *queue);
+
+// Candidates for the next unit. 'remaining' is the work not yet
+// handed out, 'total_rate' is the sum of rates of FPGAs that take it
+// (0 if unknown, the unit isn't reduced then)
+uint64_t work_queue_count(struct work_queue *queue, uint64_t remaining,
+		double total_rate);
+
+// Unit was sent with packet 'pkt_id'. Returns NULL if the queue is full
+struct work_unit *work_queue_add(struct work_queue *queue,
+		unsigned short pkt_id, uint64_t start, uint64_t count);
+
+// There's no work for the FPGA at the moment. If it runs out of
+// units, that isn't starvation
+void work_queue_no_work(struct work_queue *queue);
+
+// Index of the unit, -1 if it isn't in the queue
+int work_queue_find(struct work_queue *queue, unsigned short pkt_id);
+
+// PROCESSING_DONE received. Updates the rate, removes the unit
+// (copied to 'unit' if not NULL).
+// Returns -1 if the packet isn't in the queue
+int work_queue_done(struct work_queue *queue, unsigned short pkt_id,
+		unsigned int num_processed, struct work_unit *unit);
+
+// Unit wasn't sent, it's removed (copied to 'unit' if not NULL),
+// the rate isn't updated.
+// Returns -1 if the packet isn't in the queue
+int work_queue_cancel(struct work_queue *queue, unsigned short pkt_id,
+		struct work_unit *unit);
+
+// FPGA failed: units are removed, rate is reset
+void work_queue_clear(struct work_queue *queue);